@@ -67,6 +67,11 @@ int Disassemble(const void *instruction, ARM_INSTRUCTION *instData)
                 instData->value[0] = B_EXTRACT(inst, 3, 0);
                 instData->argCount = 1;
                 break;
+        case ARM_B_INSTRUCTION:
+                instData->instruction = ARM_INST_B;
+                instData->value[0] = B_EXTRACT(inst, 23, 0);    //Signed offset in words
+                instData->argCount = 1;
+                break;
         case ARM_ADR_INSTRUCTION:
                 instData->instruction = ARM_EXTRA_TYPE_EXTRACT(inst);
                 if(instData->instruction == (Instructions)ARM_ADR_INSTRUCTION) instData->instruction = ARM_INST_ADR; //two possible encodings
@@ -113,6 +118,9 @@ int Assemble(ARM_INSTRUCTION *instData, SceUInt *instruction)
         case ARM_BRANCH_INSTRUCTION:
                 tmp = ((SceUInt)0xE12FFF1 << 4) | instData->value[0];
                 break;
+        case ARM_B_INSTRUCTION:
+                tmp |= B_EXTRACT(instData->value[0], 23, 0);
+                break;
         default:
                 return -1;
         }
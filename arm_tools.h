@@ -27,6 +27,8 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #define ARM_CONDITION_EXTRACT(x) (B_EXTRACT(x, 31, 28))
 #define ARM_TYPE_EXTRACT(x) (B_EXTRACT(x, 27, 24))
 #define ARM_EXTRA_TYPE_EXTRACT(x) (B_EXTRACT(x, 23, 20))
+#define ARM_B_MIN_OFFSET (-0x2000000)   //Reach of the 24 bit word offset of B, from the instruction + 8
+#define ARM_B_MAX_OFFSET 0x1FFFFFC
 
 typedef enum {
         ARM_R0 = 0,
@@ -60,6 +62,7 @@ typedef enum {
         ARM_INST_SVC = 15,
         ARM_INST_BX = 1,
         ARM_INST_BLX = 3,
+        ARM_INST_B = 10,
         ARM_INST_UNKNOWN
 }Instructions;
 
@@ -69,6 +72,7 @@ typedef enum {
         ARM_SVC_INSTRUCTION = 15,
         ARM_MVN_INSTRUCTION = 14,
         ARM_BRANCH_INSTRUCTION = 1,
+        ARM_B_INSTRUCTION = 10,
         ARM_UNKN_INSTRUCTION
 }InstructionType;
 
@@ -20,9 +20,16 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #define VHL_CONFIG_H
 
 typedef enum{
-  VARIABLE_EXIT_MASK = 1
+  VARIABLE_EXIT_MASK = 1,
+  VARIABLE_LAZY_BINDING = 2,            //Bind the function imports of the next loads on their first call
+  VARIABLE_LAZY_BOUND_IMPORTS = 3,      //Function imports bound on their first call so far
+  VARIABLE_VM_TRANSITIONS_SAVED = 4,    //VM domain transitions avoided by nesting patch sessions
+  VARIABLE_STUB_TEMPLATE_HITS = 5,      //Stubs analyzed by matching a known shape
+  VARIABLE_STUB_DISASSEMBLED = 6,       //Stubs that had to go through the disassembler
+  VARIABLE_DEVIRTUALIZE_CALLS = 7,      //Make the calls of the next loads branch to imported functions directly
+  VARIABLE_DEVIRTUALIZED_CALLS = 8      //Call sites rewritten so far
 } INT_VARIABLE_OPTIONS;
-#define INT_VARIABLE_OPTION_COUNT 1
+#define INT_VARIABLE_OPTION_COUNT 8
 
 
 #define KERNEL_MODULE_SIZE 0x10000
@@ -38,6 +45,9 @@ typedef enum{
         #error Define either REJUVENATE_UNITY or REJUVENATE_PSM depending on the target platform
 #endif
 
+//Loader data directory
+#define VHL_DATA_PATH FS_ROOT"/vhl"
+
 #define VFS_ROOT "vfs0:"
 //Application directory
 #define FS_APPS_DIR FS_ROOT"/app/"
@@ -45,7 +55,14 @@ typedef enum{
 
 #define MENU_PATH VFS_ROOT"/homebrew.self"
 
-#define NID_STORAGE_MAX_BUCKET_ENTRIES 64
+#define NID_STORAGE_MAX_LOAD_FACTOR 85   //Percentage of NID storage slots that may be filled
+#define NID_STORAGE_MAX_PROBE_LENGTH 64  //Longest displacement an entry may have from its home slot
+#define NID_STORAGE_BATCH_SIZE 64        //Entries ordered together by a bulk insertion, at most 256
+#define NID_STORAGE_LOOKASIDE_SETS 256   //Sets of the 2-way cache of recently resolved NIDs, a power of 2
+#define NID_FILTER_BITS_PER_NID 10       //Bloom filter bits per stored NID, 4 hashes give about 1% false positives
+#define NID_TABLE_MAX_MODULES 256
+#define NID_TABLE_LOCATED_BITS 8         //Memoized module information locations, 1 << NID_TABLE_LOCATED_BITS
+#define NID_TABLE_SCAN_WORKERS 3         //Threads scanning the loaded modules, one per user core
 #define MAX_SLOTS 64
 
 int config_initialize();
@@ -17,6 +17,7 @@
    Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
  */
 #include <psp2/kernel/sysmem.h>
+#include <psp2/kernel/processmgr.h>
 #include "utils/utils.h"
 #include "elf_parser.h"
 #include "nid_table.h"
@@ -27,7 +28,6 @@ int block_manager_free_old_data(allocData *p)
 
         sceKernelFreeMemBlock(p->data_mem_uid);
         sceKernelFreeMemBlock(p->exec_mem_uid);
-        sceKernelFreeMemBlock(p->elf_mem_uid);
 
         p->data_mem_loc = 0;
         p->data_mem_uid = 0;
@@ -35,11 +35,10 @@ int block_manager_free_old_data(allocData *p)
         p->exec_mem_loc = 0;
         p->exec_mem_uid = 0;
         p->exec_mem_size = 0;
-        p->elf_mem_loc = 0;
-        p->elf_mem_uid = 0;
-        p->elf_mem_size = 0;
         p->entryPoint = NULL;
         p->path[0] = 0;
+        p->mod_info = NULL;
+        p->mod_base = 0;
 
         return 0;
 }
@@ -55,16 +54,15 @@ void block_manager_initialize()
                 allocatedBlocks[curSlot].exec_mem_loc = 0;
                 allocatedBlocks[curSlot].exec_mem_uid = 0;
                 allocatedBlocks[curSlot].exec_mem_size = 0;
-                allocatedBlocks[curSlot].elf_mem_loc = 0;
-                allocatedBlocks[curSlot].elf_mem_uid = 0;
-                allocatedBlocks[curSlot].elf_mem_size = 0;
                 allocatedBlocks[curSlot].path[0] = 0;
+                allocatedBlocks[curSlot].mod_info = NULL;
+                allocatedBlocks[curSlot].mod_base = 0;
         }
 }
 
 
 /*
-   elf_parser_write_segment and elf_parser_relocate taken from UVL
+   elf_parser_write_segment taken from UVL
  * relocate.c - Performs SCE ELF relocations
  * Copyright 2015 Yifan Lu
  *
@@ -87,205 +85,139 @@ int elf_parser_write_segment(Elf32_Phdr *phdr, SceUInt offset, void *data, SceUI
                 return -1;
         }
         if(phdr->p_flags & PF_X) {
-                sceKernelOpenVMDomain();
+                vm_patch_begin();
         }
 
         memcpy((char*)phdr->p_vaddr + offset, data, len);
 
         if(phdr->p_flags & PF_X) {
-                sceKernelCloseVMDomain();
+                vm_patch_end();
         }
         return 0;
 }
 
-int elf_parser_relocate(void *reloc, SceUInt size, Elf32_Phdr *segs)
+//Target of a relocated call, with the Thumb bit set for Thumb code. Returns -1 for other instructions.
+static int elf_parser_call_target(SceUInt loc, SceUInt16 r_code, SceUInt *target)
+{
+        SceUInt upper, lower, sign, value;
+        SceInt offset;
+
+        if (r_code == R_ARM_THM_CALL) {
+                upper = *(SceUInt16 *)loc;
+                lower = *(SceUInt16 *)(loc + 2);
+                if ((upper & 0xf800) != 0xf000 || (lower & 0xc000) != 0xc000)
+                        return -1;
+
+                sign = (upper >> 10) & 1;
+                offset = (sign << 24) |
+                         ((~((lower >> 13) ^ sign) & 1) << 23) |
+                         ((~((lower >> 11) ^ sign) & 1) << 22) |
+                         ((upper & 0x03ff) << 12) | ((lower & 0x07ff) << 1);
+                offset = (offset << 7) >> 7;
+
+                //BL stays in Thumb, BLX goes to ARM code from the aligned PC
+                if (lower & 0x1000) *target = (loc + 4 + offset) | 1;
+                else *target = ((loc + 4) & ~3) + offset;
+                return 0;
+        }
+
+        value = *(SceUInt *)loc;
+        offset = ((SceInt)(value << 8)) >> 6;
+        if ((value & 0xfe000000) == 0xfa000000) {
+                //BLX immediate, the H bit selects the halfword
+                *target = (loc + 8 + offset + ((value >> 23) & 2)) | 1;
+                return 0;
+        }
+        if ((value & 0x0e000000) == 0x0a000000 && (value >> 28) != 0xf) {
+                *target = loc + 8 + offset;
+                return 0;
+        }
+        return -1;
+}
+
+/*
+ * Rewrites the calls through import stubs to branch to the functions the stubs were resolved to.
+ * Only runs after the imports are resolved, the stubs tell the targets.
+ */
+int elf_parser_devirtualize(void *reloc, SceUInt size, Elf32_Phdr *segs, SceUInt stub_top, SceUInt stub_btm)
 {
         SceReloc *entry;
         SceUInt pos;
         SceUInt16 r_code;
         SceUInt r_offset;
-        SceUInt r_addend;
-        SceUInt8 r_symseg;
-        SceUInt8 r_datseg;
-        SceInt offset;
-        SceUInt symval, loc;
+        SceUInt loc, stub, target;
         SceUInt upper, lower, sign, j1, j2;
         SceUInt value;
+        SceInt offset;
+        nidTable_entry resolved;
+        int count = 0;
 
         pos = 0;
         while (pos < size)
         {
-                // get entry
                 entry = (SceReloc *)((char *)reloc + pos);
                 if (SCE_RELOC_IS_SHORT (*entry))
                 {
                         r_offset = SCE_RELOC_SHORT_OFFSET (entry->r_short);
-                        r_addend = SCE_RELOC_SHORT_ADDEND (entry->r_short);
                         pos += 8;
                 }
                 else
                 {
                         r_offset = SCE_RELOC_LONG_OFFSET (entry->r_long);
-                        r_addend = SCE_RELOC_LONG_ADDEND (entry->r_long);
-                        if (SCE_RELOC_LONG_CODE2 (entry->r_long))
-                        {
-                                DEBUG_LOG ("Code2 ignored for relocation at %X.", pos);
-                        }
                         pos += 12;
                 }
 
-                // get values
-                r_symseg = SCE_RELOC_SYMSEG (*entry);
-                r_datseg = SCE_RELOC_DATSEG (*entry);
-                symval = r_symseg == 15 ? 0 : (SceUInt)segs[r_symseg].p_vaddr;
-                loc = (SceUInt)segs[r_datseg].p_vaddr + r_offset;
-
-                // perform relocation
-                // taken from linux/arch/arm/kernel/module.c of Linux Kernel 4.0
                 r_code = SCE_RELOC_CODE(*entry);
-                switch (r_code)
-                {
-                case R_ARM_V4BX:
-                {
-                        /* Preserve Rm and the condition code. Alter
-                         * other bits to re-code instruction as
-                         * MOV PC,Rm.
-                         */
-                        value = (*(SceUInt *)loc & 0xf000000f) | 0x01a0f000;
-                }
-                break;
-                case R_ARM_ABS32:
-                case R_ARM_TARGET1:
-                {
-                        value = r_addend + symval;
-                }
-                break;
-                case R_ARM_REL32:
-                case R_ARM_TARGET2:
-                {
-                        value = r_addend + symval - loc;
-                }
-                break;
-                case R_ARM_THM_CALL:
-                {
-                        upper = *(SceUInt16 *)loc;
-                        lower = *(SceUInt16 *)(loc + 2);
-
-                        /*
-                         * 25 bit signed address range (Thumb-2 BL and B.W
-                         * instructions):
-                         *   S:I1:I2:imm10:imm11:0
-                         * where:
-                         *   S     = upper[10]   = offset[24]
-                         *   I1    = ~(J1 ^ S)   = offset[23]
-                         *   I2    = ~(J2 ^ S)   = offset[22]
-                         *   imm10 = upper[9:0]  = offset[21:12]
-                         *   imm11 = lower[10:0] = offset[11:1]
-                         *   J1    = lower[13]
-                         *   J2    = lower[11]
-                         */
-                        sign = (upper >> 10) & 1;
-                        j1 = (lower >> 13) & 1;
-                        j2 = (lower >> 11) & 1;
-                        offset = r_addend + symval - loc;
-
-                        if (offset <= (SceInt)0xff000000 ||
-                            offset >= (SceInt)0x01000000) {
-                                DEBUG_LOG ("reloc %x out of range: 0x%08X", pos, symval);
-                                break;
-                        }
+                if (r_code != R_ARM_THM_CALL && r_code != R_ARM_CALL && r_code != R_ARM_JUMP24)
+                        continue;
+
+                loc = (SceUInt)segs[SCE_RELOC_DATSEG(*entry)].p_vaddr + r_offset;
+                if (elf_parser_call_target(loc, r_code, &stub) < 0 || B_ODD(stub) ||
+                    stub < stub_top || stub >= stub_btm)
+                        continue;
+
+                //Syscalls and stubs left for lazy binding keep going through the stub
+                if (nid_table_decodeStub((void *)stub, &resolved) != ANALYZE_STUB_OK ||
+                    resolved.type != ENTRY_TYPES_FUNCTION)
+                        continue;
+                target = resolved.value.i;
+
+                if (r_code == R_ARM_THM_CALL) {
+                        //BL to Thumb code, BLX to ARM code
+                        offset = B_ODD(target) ? (SceInt)(B_UNSET(target, 0) - (loc + 4))
+                                               : (SceInt)(target - ((loc + 4) & ~3));
+                        if (offset < (SceInt)0xff000000 || offset > (SceInt)0x00fffffe)
+                                continue;
 
                         sign = (offset >> 24) & 1;
                         j1 = sign ^ (~(offset >> 23) & 1);
                         j2 = sign ^ (~(offset >> 22) & 1);
-                        upper = (SceUInt16)((upper & 0xf800) | (sign << 10) |
-                                            ((offset >> 12) & 0x03ff));
-                        lower = (SceUInt16)((lower & 0xd000) |
-                                            (j1 << 13) | (j2 << 11) |
-                                            ((offset >> 1) & 0x07ff));
+                        upper = (SceUInt16)(0xf000 | (sign << 10) | ((offset >> 12) & 0x03ff));
+                        lower = (SceUInt16)(0xc000 | (B_ODD(target) ? 0x1000 : 0) |
+                                            (j1 << 13) | (j2 << 11) | ((offset >> 1) & 0x07ff));
 
                         value = ((SceUInt)lower << 16) | upper;
-                }
-                break;
-                case R_ARM_CALL:
-                case R_ARM_JUMP24:
-                {
-                        offset = r_addend + symval - loc;
-                        if (offset <= (SceInt)0xfe000000 ||
-                            offset >= (SceInt)0x02000000) {
-                                DEBUG_LOG ("reloc %x out of range: 0x%08X", pos, symval);
-                                break;
-                        }
-
-                        offset >>= 2;
-                        offset &= 0x00ffffff;
-
-                        value = (*(SceUInt *)loc & 0xff000000) | offset;
-                }
-                break;
-                case R_ARM_PREL31:
-                {
-                        offset = r_addend + symval - loc;
-                        value = offset & 0x7fffffff;
-                }
-                break;
-                case R_ARM_MOVW_ABS_NC:
-                case R_ARM_MOVT_ABS:
-                {
-                        offset = symval + r_addend;
-                        if (SCE_RELOC_CODE (*entry) == R_ARM_MOVT_ABS)
-                                offset >>= 16;
-
+                } else {
                         value = *(SceUInt *)loc;
-                        value &= 0xfff0f000;
-                        value |= ((offset & 0xf000) << 4) |
-                                 (offset & 0x0fff);
-                }
-                break;
-                case R_ARM_THM_MOVW_ABS_NC:
-                case R_ARM_THM_MOVT_ABS:
-                {
-                        upper = *(SceUInt16 *)loc;
-                        lower = *(SceUInt16 *)(loc + 2);
-
-                        /*
-                         * MOVT/MOVW instructions encoding in Thumb-2:
-                         *
-                         * i    = upper[10]
-                         * imm4 = upper[3:0]
-                         * imm3 = lower[14:12]
-                         * imm8 = lower[7:0]
-                         *
-                         * imm16 = imm4:i:imm3:imm8
-                         */
-                        offset = r_addend + symval;
-
-                        if (SCE_RELOC_CODE (*entry) == R_ARM_THM_MOVT_ABS)
-                                offset >>= 16;
-
-                        upper = (SceUInt16)((upper & 0xfbf0) |
-                                            ((offset & 0xf000) >> 12) |
-                                            ((offset & 0x0800) >> 1));
-                        lower = (SceUInt16)((lower & 0x8f00) |
-                                            ((offset & 0x0700) << 4) |
-                                            (offset & 0x00ff));
-
-                        value = ((SceUInt)lower << 16) | upper;
-                }
-                break;
-                default:
-                {
-                        DEBUG_LOG ("Unknown relocation code %u at %x", r_code, pos);
-                }
-                case R_ARM_NONE:
-                        continue;
+                        offset = (SceInt)(B_UNSET(target, 0) - (loc + 8));
+                        if (offset < (SceInt)0xfe000000 || offset > (SceInt)0x01fffffc)
+                                continue;
+
+                        //ARM code keeps the BL or B, Thumb code needs BLX which only exists unconditionally as a call
+                        if (B_EVEN(target)) {
+                                value = (value & 0xff000000) | ((offset >> 2) & 0x00ffffff);
+                        } else if (r_code == R_ARM_CALL && (value >> 28) == ARM_CONDITION_ALWAYS) {
+                                value = 0xfa000000 | ((offset & 2) << 23) | ((offset >> 2) & 0x00ffffff);
+                        } else {
+                                continue;
+                        }
                 }
 
-                // write value
-                elf_parser_write_segment(&segs[r_datseg], r_offset, &value, sizeof (value));
+                if (elf_parser_write_segment(&segs[SCE_RELOC_DATSEG(*entry)], r_offset, &value, sizeof (value)) == 0)
+                        count++;
         }
 
-        return 0;
+        return count;
 }
 
 int elf_parser_find_SceModuleInfo(Elf32_Ehdr *elf_hdr, Elf32_Phdr *elf_phdrs, SceModuleInfo **mod_info)
@@ -352,38 +284,345 @@ int elf_parser_load_sce_exec()
         return -1;
 }
 
-int elf_parser_load_sce_relexec(allocData *data, SceUID fd, unsigned int len, Elf32_Ehdr *hdr, void **entryPoint)
+static void elf_parser_report_import(elf_parser_report *report, SceModuleImports *imports, int source)
 {
-        if(data->data_mem_uid != 0) block_manager_free_old_data(data); //Make sure the block is empty to prevent memory leaks
-        char tmpDS_name[18];
-        snprintf(tmpDS_name, 18, "elf_data_store%08X", data);
+        SceNID library = GET_NID(imports);
+        const char *name = GET_LIB_NAME(imports);
+        elf_parser_report_library *entry;
+        unsigned int i;
+
+        switch(source)
+        {
+        case RESOLVE_STUB_HOOK:
+                report->hooks++;
+                return;
+        case RESOLVE_STUB_LOOKASIDE:
+                report->lookaside++;
+                return;
+        case RESOLVE_STUB_TABLE:
+                report->table++;
+                return;
+        case RESOLVE_STUB_OTHER_LIBRARY:
+                report->other_library++;
+                return;
+        default:
+                break;
+        }
 
+        report->unresolved++;
+        for(i = 0; i < report->library_count; i++)
+                if(report->libraries[i].library == library) break;
 
-        SceUID tmpDataStore_uid = sceKernelAllocMemBlock(tmpDS_name, SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, FOUR_KB_ALIGN(len), NULL);
-        void *tmpDataStore_loc = NULL;
+        entry = &report->libraries[i];
+        if(i == report->library_count) {
+                if(i == ELF_PARSER_REPORT_LIBRARIES) {
+                        report->unlisted++;
+                        return;
+                }
+                entry->library = library;
+                entry->unresolved = 0;
+                for(i = 0; name != NULL && name[i] != 0 && i < ELF_PARSER_REPORT_NAME_LENGTH - 1; i++)
+                        entry->name[i] = name[i];
+                entry->name[i] = 0;
+                report->library_count++;
+        }
+        entry->unresolved++;
+}
+
+//Reads len bytes of the file at offset straight to their destination
+static int elf_parser_read(SceUID fd, SceUInt offset, void *dst, SceUInt len)
+{
+        elf_parser_report *report = &getGlobals()->load_report;
+        SceUInt32 start = sceKernelGetProcessTimeLow();
+        int read;
 
-        if(tmpDataStore_uid < 0) {
-                DEBUG_LOG_("Failed to allocate memory for homebrew");
+        if(sceIoLseek(fd, (SceOff)offset, PSP2_SEEK_SET) != (SceOff)offset) {
+                DEBUG_LOG("Failed to seek to 0x%08X", offset);
                 return -1;
         }
-        if(sceKernelGetMemBlockBase(tmpDataStore_uid, &tmpDataStore_loc) < 0) {
-                DEBUG_LOG_("Failed to retrieve allocated memory for homebrew");
-                goto freeTmpDataAndError;
+        while(len > 0) {
+                read = sceIoRead(fd, dst, len);
+                if(read <= 0) {
+                        DEBUG_LOG("Read failed 0x%08X", read);
+                        return -1;
+                }
+                dst = (char *)dst + read;
+                len -= read;
+        }
+
+        report->read_time += sceKernelGetProcessTimeLow() - start;
+        return 0;
+}
+
+//Bytes of the complete relocation entries at the start of the buffer
+static SceUInt elf_parser_reloc_span(const SceUInt8 *buffer, SceUInt size)
+{
+        SceUInt pos = 0, next;
+
+        while(pos + 8 <= size) {
+                next = pos + (SCE_RELOC_IS_SHORT(*(SceReloc *)(buffer + pos)) ? 8 : 12);
+                if(next > size) break;
+                pos = next;
+        }
+        return pos;
+}
+
+static void elf_parser_reloc_open(elf_parser_reloc_stream *stream, SceUID fd, const Elf32_Phdr *phdr)
+{
+        stream->fd = fd;
+        stream->offset = phdr->p_offset;
+        stream->left = phdr->p_filesz;
+        stream->size = 0;
+        stream->span = 0;
+}
+
+//Refills the buffer, returns the bytes of the complete entries at its start or 0 at the end of the segment
+static int elf_parser_reloc_next(elf_parser_reloc_stream *stream)
+{
+        SceUInt8 *buffer = (SceUInt8 *)stream->buffer;
+        SceUInt len, pos;
+
+        //The entry cut by the end of the last read moves to the start
+        stream->size -= stream->span;
+        for(pos = 0; pos < stream->size; pos++)
+                buffer[pos] = buffer[stream->span + pos];
+
+        len = sizeof(stream->buffer) - stream->size;
+        if(len > stream->left) len = stream->left;
+        if(len > 0) {
+                if(elf_parser_read(stream->fd, stream->offset, buffer + stream->size, len) < 0) return -1;
+                stream->offset += len;
+                stream->left -= len;
+                stream->size += len;
+        }
+
+        stream->span = elf_parser_reloc_span(buffer, stream->size);
+        return stream->span;
+}
+
+static elf_parser_pipeline *elf_parser_pipeline_alloc(SceUID fd, Elf32_Phdr *segs, SceUInt count)
+{
+        elf_parser_pipeline *pipe;
+        SceUID uid;
+        void *p;
+
+        uid = sceKernelAllocMemBlock("vhlLoadPipeline", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW,
+                                     FOUR_KB_ALIGN(sizeof(elf_parser_pipeline)), NULL);
+        if(uid < 0) {
+                DEBUG_LOG("Failed to allocate load pipeline 0x%08X", uid);
+                return NULL;
+        }
+        if(sceKernelGetMemBlockBase(uid, &p) < 0) {
+                DEBUG_LOG_("Failed to retrieve load pipeline memory");
+                sceKernelFreeMemBlock(uid);
+                return NULL;
+        }
+
+        pipe = p;
+        memset(pipe, 0, sizeof(elf_parser_pipeline));
+        pipe->uid = uid;
+        pipe->fd = fd;
+        pipe->segs = segs;
+        pipe->count = count;
+
+        return pipe;
+}
+
+/*
+ * Reads the next data segment, or the next chunk of code or relocations into a free buffer.
+ * Returns 0 once everything is read. Loads are all read in the first pass, so the
+ * relocations of the second pass only ever patch data that is already there. Only the
+ * thread holding the patch session can write the executable segments, their code is
+ * staged in the buffers for it to copy.
+ */
+static int elf_parser_pipeline_step(elf_parser_pipeline *pipe)
+{
+        Elf32_Phdr *seg = NULL;
+        elf_parser_pipeline_buffer *buffer;
+        SceUInt8 *bytes;
+        SceUInt len, span;
+
+        while(pipe->index < pipe->count) {
+                seg = &pipe->segs[pipe->index];
+                if(seg->p_type == (pipe->pass == 0 ? PH_LOAD : PH_SCE_RELOCATE) && pipe->done < seg->p_filesz) break;
+
+                pipe->index++;
+                pipe->done = 0;
+                pipe->carry_size = 0;
+                if(pipe->index == pipe->count && pipe->pass == 0) {
+                        pipe->pass = 1;
+                        pipe->index = 0;
+                }
+        }
+        if(pipe->index == pipe->count) return 0;
+
+        if(pipe->pass == 0 && !(seg->p_flags & PF_X)) {
+                if(elf_parser_read(pipe->fd, seg->p_offset, (void *)seg->p_vaddr, seg->p_filesz) < 0) return -1;
+                pipe->done = seg->p_filesz;
+                return 1;
+        }
+
+        buffer = &pipe->buffers[pipe->produced % ELF_PARSER_PIPELINE_BUFFERS];
+        bytes = (SceUInt8 *)buffer->data;
+
+        if(pipe->pass == 0) {
+                len = sizeof(buffer->data);
+                if(len > seg->p_filesz - pipe->done) len = seg->p_filesz - pipe->done;
+                if(elf_parser_read(pipe->fd, seg->p_offset + pipe->done, bytes, len) < 0) return -1;
+
+                buffer->seg = seg;
+                buffer->offset = pipe->done;
+                buffer->size = len;
+                pipe->done += len;
+
+                __sync_synchronize();
+                pipe->produced++;
+                return 1;
+        }
+
+        //The entry cut by the end of the last chunk starts the next one
+        buffer->seg = NULL;
+        memcpy(bytes, pipe->carry, pipe->carry_size);
+
+        len = sizeof(buffer->data) - pipe->carry_size;
+        if(len > seg->p_filesz - pipe->done) len = seg->p_filesz - pipe->done;
+        if(elf_parser_read(pipe->fd, seg->p_offset + pipe->done, bytes + pipe->carry_size, len) < 0) return -1;
+        pipe->done += len;
+        len += pipe->carry_size;
+
+        span = elf_parser_reloc_span(bytes, len);
+        pipe->carry_size = len - span;
+        memcpy(pipe->carry, bytes + span, pipe->carry_size);
+        buffer->size = span;
+
+        //The chunk has to be complete before the loader sees it
+        __sync_synchronize();
+        pipe->produced++;
+        return 1;
+}
+
+static int readerThread(SceSize args __attribute__((unused)), void *argp)
+{
+        elf_parser_pipeline *pipe = *(elf_parser_pipeline **)argp;
+        int res;
+
+        do {
+                while(pipe->produced - pipe->consumed == ELF_PARSER_PIPELINE_BUFFERS)
+                        sceKernelDelayThread(ELF_PARSER_PIPELINE_POLL);
+                //The loader is done with the buffer before it is refilled
+                __sync_synchronize();
+                res = elf_parser_pipeline_step(pipe);
+        } while(res > 0);
+
+        pipe->failed = res < 0;
+        __sync_synchronize();
+        pipe->finished = 1;
+        return 0;
+}
+
+/*
+ * Loads the segments and applies their relocations. A reader thread issues the reads while
+ * this thread clears the BSS, copies the code and relocates the chunks that have arrived,
+ * the VM domain letting the executable segments be written is only open for this thread.
+ * Without the reader the reads are issued from here whenever there is nothing left to do.
+ */
+static int elf_parser_pipeline_run(elf_parser_pipeline *pipe)
+{
+        elf_parser_report *report = &getGlobals()->load_report;
+        SceUInt32 start = sceKernelGetProcessTimeLow(), work = 0, reads = report->read_time, phase;
+        elf_parser_pipeline_buffer *buffer;
+        Elf32_Phdr *segs = pipe->segs;
+        SceUID thid;
+        int finished, res;
+
+        thid = sceKernelCreateThread("vhlLoadReader", readerThread, ELF_PARSER_PIPELINE_PRIORITY,
+                                     ELF_PARSER_PIPELINE_STACK_SIZE, 0, 0, NULL);
+        if(thid < 0) {
+                DEBUG_LOG("Failed to create load reader 0x%08X", thid);
+        }else if(sceKernelStartThread(thid, sizeof(pipe), &pipe) < 0) {
+                DEBUG_LOG_("Failed to start load reader");
+                sceKernelDeleteThread(thid);
+                thid = -1;
+        }
+
+        phase = sceKernelGetProcessTimeLow();
+        for(SceUInt i = 0; i < pipe->count; i++) {
+                if(segs[i].p_type != PH_LOAD) continue;
+
+                vm_patch_begin();
+                DEBUG_LOG_("Clearing memory...");
+                memset ((void*)(segs[i].p_vaddr + segs[i].p_filesz), 0, segs[i].p_memsz - segs[i].p_filesz);  //TODO this is failing for some reason
+                vm_patch_end();
+        }
+        work += sceKernelGetProcessTimeLow() - phase;
+
+        for(;;) {
+                finished = pipe->finished;
+                __sync_synchronize();
+
+                if(pipe->consumed != pipe->produced) {
+                        buffer = &pipe->buffers[pipe->consumed % ELF_PARSER_PIPELINE_BUFFERS];
+
+                        phase = sceKernelGetProcessTimeLow();
+                        if(buffer->seg != NULL)
+                                memcpy((void *)(buffer->seg->p_vaddr + buffer->offset), buffer->data, buffer->size);
+                        else
+                                elf_relocate_apply(buffer->data, buffer->size, segs, pipe->count, pipe->scratch);
+                        work += sceKernelGetProcessTimeLow() - phase;
+
+                        __sync_synchronize();
+                        pipe->consumed++;
+                }else if(finished) {
+                        break;
+                }else if(thid < 0) {
+                        res = elf_parser_pipeline_step(pipe);
+                        if(res <= 0) {
+                                pipe->failed = res < 0;
+                                pipe->finished = 1;
+                        }
+                }else{
+                        sceKernelDelayThread(ELF_PARSER_PIPELINE_POLL);
+                }
         }
 
-        sceIoLseek(fd, 0, PSP2_SEEK_SET);
-        if(sceIoRead(fd, tmpDataStore_loc, len) <= 0) {
-                DEBUG_LOG_("Read failed");
-                goto freeTmpDataAndError;
+        if(thid >= 0) {
+                sceKernelWaitThreadEnd(thid, NULL, NULL);
+                sceKernelDeleteThread(thid);
         }
 
-        //retrieve program sections
+        //Whatever the reads and the work took beyond the time they took together was hidden
+        reads = report->read_time - reads + work;
+        phase = sceKernelGetProcessTimeLow() - start;
+        report->overlap_time = reads > phase ? reads - phase : 0;
+
+        return pipe->failed ? -1 : 0;
+}
+
+int elf_parser_load_sce_relexec(allocData *data, SceUID fd, unsigned int len, Elf32_Ehdr *hdr, void **entryPoint)
+{
+        elf_parser_report *report = &getGlobals()->load_report;
+        SceUInt32 start = sceKernelGetProcessTimeLow(), phase;
+        Elf32_Phdr prgmHDR[ELF_PARSER_MAX_SEGMENTS];
+        elf_parser_pipeline *pipe;
+        int span;
+
+        memset(report, 0, sizeof(elf_parser_report));
+
+        if(data->data_mem_uid != 0) block_manager_free_old_data(data); //Make sure the block is empty to prevent memory leaks
+
+        //Only the program headers are read up front, the segments are read straight to their destination
         if(hdr->e_phnum < 1) {
                 DEBUG_LOG_("No program sections!");
-                goto freeTmpDataAndError;
+                return -1;
+        }
+        if(hdr->e_phnum > ELF_PARSER_MAX_SEGMENTS || hdr->e_phentsize != sizeof(Elf32_Phdr)) {
+                DEBUG_LOG("Unsupported program headers, %d of %d bytes", hdr->e_phnum, hdr->e_phentsize);
+                return -1;
+        }
+        if(elf_parser_read(fd, hdr->e_phoff, prgmHDR, hdr->e_phnum * sizeof(Elf32_Phdr)) < 0) {
+                DEBUG_LOG_("Failed to read program headers");
+                return -1;
         }
-
-        Elf32_Phdr *prgmHDR = (Elf32_Phdr*)((SceUInt)tmpDataStore_loc + hdr->e_phoff);
 
 
         //Start parsing the sections
@@ -396,9 +635,17 @@ int elf_parser_load_sce_relexec(allocData *data, SceUID fd, unsigned int len, El
         char name[17];
 
         for(int i = 0; i < hdr->e_phnum; i++) {
+                if(prgmHDR[i].p_offset > len || prgmHDR[i].p_filesz > len - prgmHDR[i].p_offset) {
+                        DEBUG_LOG("Program Segment %d is past the end of the file", i);
+                        return -1;
+                }
                 switch(prgmHDR[i].p_type)
                 {
                 case PH_LOAD:
+                        if(prgmHDR[i].p_filesz > prgmHDR[i].p_memsz) {
+                                DEBUG_LOG("Program Segment %d is larger than its memory", i);
+                                return -1;
+                        }
                         //Count how much memory to allocate for the Load headers
                         if(prgmHDR[i].p_flags & PF_X) exec_mem_size += prgmHDR[i].p_memsz;
                         else data_mem_size += prgmHDR[i].p_memsz;
@@ -442,53 +689,44 @@ int elf_parser_load_sce_relexec(allocData *data, SceUID fd, unsigned int len, El
         data->exec_mem_loc = exec_mem_loc;
         data->exec_mem_uid = exec_mem_uid;
         data->exec_mem_size = exec_mem_size;
-        data->elf_mem_loc = tmpDataStore_loc;
-        data->elf_mem_uid = tmpDataStore_uid;
-        data->elf_mem_size = FOUR_KB_ALIGN(len);
-
-        //Second round performs the actual parsing and allocation
-        void *block_loc = NULL;
 
+        //Every segment gets its address before any relocation refers to it
         for(int i = 0; i < hdr->e_phnum; i++) {
-                switch(prgmHDR[i].p_type)
-                {
-                case PH_LOAD:
-                        DEBUG_LOG_("LOAD header");
-                        //Count how much memory to allocate for the Load headers
-                        if(prgmHDR[i].p_flags & PF_X)
-                        {
-                                block_loc = exec_mem_loc;
-                                exec_mem_loc += prgmHDR[i].p_memsz;
-                                exec_mem_size -= prgmHDR[i].p_memsz;
-                        }
-                        else
-                        {
-                                block_loc = data_mem_loc;
-                                data_mem_loc += prgmHDR[i].p_memsz;
-                                data_mem_size -= prgmHDR[i].p_memsz;
-                        }
-                        prgmHDR[i].p_vaddr = (SceUInt)block_loc;
+                if(prgmHDR[i].p_type != PH_LOAD) continue;
 
-                        DEBUG_LOG_("Writing Segment...");
-                        elf_parser_write_segment(&prgmHDR[i], 0, (void*)((SceUInt)tmpDataStore_loc + prgmHDR[i].p_offset), prgmHDR[i].p_filesz);
+                if(prgmHDR[i].p_flags & PF_X)
+                {
+                        prgmHDR[i].p_vaddr = (SceUInt)exec_mem_loc;
+                        exec_mem_loc += prgmHDR[i].p_memsz;
+                }
+                else
+                {
+                        prgmHDR[i].p_vaddr = (SceUInt)data_mem_loc;
+                        data_mem_loc += prgmHDR[i].p_memsz;
+                }
+        }
 
-                        sceKernelOpenVMDomain();
-                        DEBUG_LOG_("Clearing memory...");
-                        memset ((void*)((SceUInt)block_loc + (SceUInt)prgmHDR[i].p_filesz), 0, prgmHDR[i].p_memsz - prgmHDR[i].p_filesz);  //TODO this is failing for some reason
-                        sceKernelCloseVMDomain();
+        //Second round performs the actual parsing and allocation
+        pipe = elf_parser_pipeline_alloc(fd, prgmHDR, hdr->e_phnum);
+        if(pipe == NULL) goto freeAllAndError;
 
-                        DEBUG_LOG_("Loaded LOAD section");
+        //Segments, relocations and stubs are all written inside a single session
+        vm_patch_begin();
+        phase = sceKernelGetProcessTimeLow();
 
-                        break;
-                case PH_SCE_RELOCATE:
-                        DEBUG_LOG_("RELOCATE header");
-                        elf_parser_relocate ((void*)((SceUInt)tmpDataStore_loc + prgmHDR[i].p_offset), prgmHDR[i].p_filesz, prgmHDR);
-                        break;
-                default:
+        for(int i = 0; i < hdr->e_phnum; i++)
+                if(prgmHDR[i].p_type != PH_LOAD && prgmHDR[i].p_type != PH_SCE_RELOCATE)
                         DEBUG_LOG("Program Segment %d can not be loaded", i);
-                        break;
-                }
+
+        if(elf_parser_pipeline_run(pipe) < 0) {
+                DEBUG_LOG_("Failed to load the segments");
+                sceKernelFreeMemBlock(pipe->uid);
+                vm_patch_end();
+                goto freeAllAndError;
         }
+        DEBUG_LOG("Segments loaded, %u us of reading overlapped", report->overlap_time);
+
+        report->segment_time = sceKernelGetProcessTimeLow() - phase;
 
         //Finally, resolve all stubs
         SceModuleInfo *mod_info;
@@ -496,10 +734,20 @@ int elf_parser_load_sce_relexec(allocData *data, SceUID fd, unsigned int len, El
         if(index < 0)
         {
                 DEBUG_LOG_("Failed to find SceModuleInfo section...");
+                sceKernelFreeMemBlock(pipe->uid);
+                vm_patch_end();
                 goto freeAllAndError;
         }
         DEBUG_LOG_("ModuleInfo found");
 
+        data->mod_info = mod_info;
+        data->mod_base = prgmHDR[index].p_vaddr;
+
+        //Lazily bound functions go through the trampoline until their first call, variables are always resolved now
+        int lazy = vhlGetIntValue(VARIABLE_LAZY_BINDING);
+        SceUInt stub_top = 0xFFFFFFFF, stub_btm = 0;
+
+        phase = sceKernelGetProcessTimeLow();
         FOREACH_IMPORT(prgmHDR[index].p_vaddr, mod_info, imports)
         {
                 void **entryTable = GET_FUNCTIONS_ENTRYTABLE(imports);
@@ -507,8 +755,17 @@ int elf_parser_load_sce_relexec(allocData *data, SceUID fd, unsigned int len, El
 
                 for(unsigned int i = 0; i < GET_FUNCTION_COUNT(imports); i++)
                 {
-                        int err = nid_table_resolveStub(entryTable[i], nidTable[i]);
-                        if(err < 0) DEBUG_LOG("Failed to resolve import NID 0x%08x", nidTable[i]);
+                        if((SceUInt)entryTable[i] < stub_top) stub_top = (SceUInt)entryTable[i];
+                        if((SceUInt)entryTable[i] + 16 > stub_btm) stub_btm = (SceUInt)entryTable[i] + 16;
+
+                        report->imports++;
+                        //Thumb stubs do not follow the 16 byte ARM layout the trampoline expects
+                        if(lazy && !((SceUInt)entryTable[i] & 1)) {
+                                nid_table_deferStub(entryTable[i], nidTable[i]);
+                                report->deferred++;
+                                continue;
+                        }
+                        elf_parser_report_import(report, imports, nid_table_resolveStub(entryTable[i], GET_NID(imports), nidTable[i]));
                 }
 
                 entryTable = GET_VARIABLE_ENTRYTABLE(imports);
@@ -516,10 +773,34 @@ int elf_parser_load_sce_relexec(allocData *data, SceUID fd, unsigned int len, El
 
                 for(int i = 0; i < GET_VARIABLE_COUNT(imports); i++)
                 {
-                        int err = nid_table_resolveStub(entryTable[i], nidTable[i]);
-                        if(err < 0) DEBUG_LOG("Failed to resolve variable NID 0x%08x", nidTable[i]);
+                        report->imports++;
+                        elf_parser_report_import(report, imports, nid_table_resolveStub(entryTable[i], GET_NID(imports), nidTable[i]));
                 }
         }
+        report->import_time = sceKernelGetProcessTimeLow() - phase;
+
+        //The calls through the stubs can only be rewritten once the stubs are resolved
+        if(vhlGetIntValue(VARIABLE_DEVIRTUALIZE_CALLS) && stub_btm > stub_top) {
+                int rewritten = 0;
+
+                phase = sceKernelGetProcessTimeLow();
+
+                //The relocations are read again rather than kept from the first pass
+                for(int i = 0; i < hdr->e_phnum; i++) {
+                        if(prgmHDR[i].p_type != PH_SCE_RELOCATE) continue;
+
+                        elf_parser_reloc_open(&pipe->stream, fd, &prgmHDR[i]);
+                        while((span = elf_parser_reloc_next(&pipe->stream)) > 0)
+                                rewritten += elf_parser_devirtualize(pipe->stream.buffer, span, prgmHDR, stub_top, stub_btm);
+                }
+
+                report->devirtualize_time = sceKernelGetProcessTimeLow() - phase;
+                getGlobals()->intOptions[VARIABLE_DEVIRTUALIZED_CALLS - 1] += rewritten;
+                DEBUG_LOG("Call sites branching to imported functions directly: %d", rewritten);
+        }
+        sceKernelFreeMemBlock(pipe->uid);
+        vm_patch_end();
+        DEBUG_LOG("VM domain transitions saved so far: %d", vhlGetIntValue(VARIABLE_VM_TRANSITIONS_SAVED));
 
         DEBUG_LOG_("Retrieving entry point");
         if(entryPoint != NULL) *entryPoint = (void *)(prgmHDR[index].p_vaddr + mod_info->mod_start);
@@ -529,12 +810,14 @@ int elf_parser_load_sce_relexec(allocData *data, SceUID fd, unsigned int len, El
         sceKernelSyncVMDomain(data->exec_mem_uid, data->exec_mem_loc, data->exec_mem_size);
         DEBUG_LOG_("Flushed");
 
+        report->total_time = sceKernelGetProcessTimeLow() - start;
+        report->size = sizeof(elf_parser_report);
+        DEBUG_LOG("Imports %u, unresolved %u, loaded in %u us", report->imports, report->unresolved, report->total_time);
+
         return 0;
 
 freeAllAndError:
         block_manager_free_old_data(data);
-freeTmpDataAndError:
-        sceKernelFreeMemBlock(tmpDataStore_uid);
         return -1;
 }
 
@@ -579,6 +862,70 @@ int elf_parser_load(allocData *data, const char *file, void **entryPoint)
         return 0;
 }
 
+#define ELF_PARSER_REPORT_PRINT(...) do { \
+        len = snprintf(line, sizeof(line), __VA_ARGS__); \
+        if(sceIoWrite(fd, line, len) != len) res = -1; \
+} while(0)
+
+int elf_parser_dumpReport(const char *path)
+{
+        const elf_parser_report *report = &getGlobals()->load_report;
+        char line[64];
+        SceUID fd;
+        int len, res = 0;
+
+        if(report->size == 0) {
+                DEBUG_LOG_("No homebrew was loaded");
+                return -1;
+        }
+
+        fd = sceIoOpen(path, PSP2_O_WRONLY | PSP2_O_CREAT | PSP2_O_TRUNC, 0777);
+        if(fd < 0) {
+                DEBUG_LOG("Failed to open load report file 0x%08X", fd);
+                return -1;
+        }
+
+        ELF_PARSER_REPORT_PRINT("imports %u\n", report->imports);
+        ELF_PARSER_REPORT_PRINT("deferred %u\n", report->deferred);
+        ELF_PARSER_REPORT_PRINT("hooks %u\n", report->hooks);
+        ELF_PARSER_REPORT_PRINT("lookaside %u\n", report->lookaside);
+        ELF_PARSER_REPORT_PRINT("table %u\n", report->table);
+        ELF_PARSER_REPORT_PRINT("other library %u\n", report->other_library);
+        ELF_PARSER_REPORT_PRINT("unresolved %u\n", report->unresolved);
+        for(unsigned int i = 0; i < report->library_count; i++)
+                ELF_PARSER_REPORT_PRINT("  %s 0x%08X %u\n", report->libraries[i].name, report->libraries[i].library,
+                                        report->libraries[i].unresolved);
+        if(report->unlisted > 0) ELF_PARSER_REPORT_PRINT("  other libraries %u\n", report->unlisted);
+        ELF_PARSER_REPORT_PRINT("read %u us\n", report->read_time);
+        ELF_PARSER_REPORT_PRINT("segments %u us\n", report->segment_time);
+        ELF_PARSER_REPORT_PRINT("imports %u us\n", report->import_time);
+        ELF_PARSER_REPORT_PRINT("devirtualize %u us\n", report->devirtualize_time);
+        ELF_PARSER_REPORT_PRINT("total %u us\n", report->total_time);
+        ELF_PARSER_REPORT_PRINT("overlapped %u us\n", report->overlap_time);
+
+        sceIoClose(fd);
+        return res;
+}
+
+int vhlGetLoadReport(elf_parser_report *report, SceUInt size)
+{
+        elf_parser_report current;
+
+        if(report == NULL) return -1;
+
+        current = getGlobals()->load_report;
+        if(size > sizeof(current)) size = sizeof(current);
+        current.size = size;
+        memcpy(report, &current, size);
+
+        return size;
+}
+
+int vhlDumpLoadReport(const char *path)
+{
+        return elf_parser_dumpReport(path != NULL ? path : ELF_PARSER_REPORT_FILE);
+}
+
 int homebrew_thread_entry(SceSize args __attribute__((unused)), void *argp)
 {
 
@@ -21,8 +21,84 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 
 #include "config.h"
 #include "elf_headers.h"
+#include "elf_relocate.h"
+#include "module_headers.h"
 #include "utils/bithacks.h"
 
+#define ELF_PARSER_REPORT_FILE VHL_DATA_PATH"/loadReport.txt"
+#define ELF_PARSER_REPORT_LIBRARIES 16
+#define ELF_PARSER_REPORT_NAME_LENGTH 32
+#define ELF_PARSER_MAX_SEGMENTS 16
+#define ELF_PARSER_RELOC_BUFFER 0x1000  //Relocation entries are streamed from the file through a buffer of this size
+#define ELF_PARSER_PIPELINE_BUFFERS 2
+#define ELF_PARSER_PIPELINE_CHUNK 0x4000        //Bytes of code or relocations the reader thread hands over at once
+#define ELF_PARSER_PIPELINE_POLL 100            //Microseconds between checks of the other side of the pipeline
+#define ELF_PARSER_PIPELINE_STACK_SIZE 0x2000
+#define ELF_PARSER_PIPELINE_PRIORITY 0x10000100 //Default priority of user threads
+
+typedef struct {
+        SceNID library;
+        SceUInt unresolved;
+        char name[ELF_PARSER_REPORT_NAME_LENGTH];
+} elf_parser_report_library;
+
+//Resolution of the last homebrew loaded, also returned to homebrew by vhlGetLoadReport, only append new fields
+typedef struct {
+        SceUInt size;                   //Bytes of the structure that were filled
+        SceUInt imports;                //Functions and variables
+        SceUInt deferred;               //Functions left to the lazy binding trampoline
+        SceUInt hooks;
+        SceUInt lookaside;
+        SceUInt table;
+        SceUInt other_library;          //Found in another library than the one imported from
+        SceUInt unresolved;
+        SceUInt unlisted;               //Unresolved imports of the libraries that did not fit below
+        SceUInt library_count;
+        elf_parser_report_library libraries[ELF_PARSER_REPORT_LIBRARIES];
+        SceUInt read_time;              //Microseconds spent in each phase, reading the file is also part of the ones below
+        SceUInt segment_time;           //Segments and relocations
+        SceUInt import_time;
+        SceUInt devirtualize_time;
+        SceUInt total_time;
+        SceUInt overlap_time;           //Reading hidden behind clearing and relocating
+} elf_parser_report;
+
+typedef struct {
+        SceUID fd;
+        SceUInt offset;                 //File offset of the next read
+        SceUInt left;                   //Bytes of the segment not read yet
+        SceUInt size;                   //Bytes in the buffer
+        SceUInt span;                   //Bytes of the complete entries at the start of the buffer
+        SceUInt buffer[ELF_PARSER_RELOC_BUFFER / sizeof(SceUInt)];
+} elf_parser_reloc_stream;
+
+typedef struct {
+        Elf32_Phdr *seg;                //Executable segment the data is copied to, NULL for relocations
+        SceUInt offset;                 //In the segment
+        SceUInt size;                   //Bytes of the code or of the complete entries
+        SceUInt data[ELF_PARSER_PIPELINE_CHUNK / sizeof(SceUInt)];
+} elf_parser_pipeline_buffer;
+
+//Shared by the loader and its reader thread, which only refills the buffers the loader has released
+typedef struct {
+        SceUID uid;
+        SceUID fd;
+        Elf32_Phdr *segs;
+        SceUInt count;
+        SceUInt pass;                   //Loads are read in the first pass, relocations in the second
+        SceUInt index;                  //Program header being read
+        SceUInt done;                   //Bytes of it read so far
+        SceUInt carry_size;             //Bytes of the entry cut by the end of the last chunk
+        SceUInt8 carry[12];
+        volatile SceUInt produced;      //Chunks handed over by the reader
+        volatile SceUInt consumed;      //Chunks relocated by the loader
+        volatile SceUInt finished;
+        volatile SceUInt failed;
+        elf_parser_pipeline_buffer buffers[ELF_PARSER_PIPELINE_BUFFERS];
+        elf_relocate_entry scratch[ELF_RELOCATE_SCRATCH_ENTRIES(ELF_PARSER_PIPELINE_CHUNK)];     //Used by the loader only
+        elf_parser_reloc_stream stream; //Relocations read again by the loader once the reader is done
+} elf_parser_pipeline;
+
 typedef struct {
         void *data_mem_loc;
         SceUID data_mem_uid;
@@ -32,13 +108,12 @@ typedef struct {
         SceUID exec_mem_uid;
         int exec_mem_size;
 
-        void *elf_mem_loc;
-        SceUID elf_mem_uid;
-        int elf_mem_size;
-
         char path[MAX_PATH_LENGTH];
         int (*entryPoint)(int, char**);
         SceUID thid;
+
+        SceModuleInfo *mod_info;        //Kept to find the library of the stubs bound lazily
+        SceUInt mod_base;
 } allocData;
 
 
@@ -47,6 +122,10 @@ int block_manager_free_old_data(allocData *data);
 
 int elf_parser_start(allocData *data, int wait);
 int elf_parser_load(allocData *data, const char* file, void** entryPoint);
+int elf_parser_dumpReport(const char *path);
+
+int vhlGetLoadReport(elf_parser_report *report, SceUInt size);
+int vhlDumpLoadReport(const char *path);
 
 
 #endif
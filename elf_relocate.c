@@ -0,0 +1,323 @@
+/*
+elf_relocate.c : Applies SCE relocations grouped by type and target segment
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+/*
+   The instruction encodings are taken from UVL
+ * relocate.c - Performs SCE ELF relocations
+ * Copyright 2015 Yifan Lu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "elf_relocate.h"
+
+static const SceUInt8 elfRelocateClasses[] = {
+        [R_ARM_NONE] = ELF_RELOCATE_NONE,
+        [R_ARM_ABS32] = ELF_RELOCATE_ABS32,
+        [R_ARM_REL32] = ELF_RELOCATE_REL32,
+        [R_ARM_THM_CALL] = ELF_RELOCATE_THM_CALL,
+        [R_ARM_CALL] = ELF_RELOCATE_ARM_BRANCH,
+        [R_ARM_JUMP24] = ELF_RELOCATE_ARM_BRANCH,
+        [R_ARM_TARGET1] = ELF_RELOCATE_ABS32,
+        [R_ARM_V4BX] = ELF_RELOCATE_V4BX,
+        [R_ARM_TARGET2] = ELF_RELOCATE_REL32,
+        [R_ARM_PREL31] = ELF_RELOCATE_PREL31,
+        [R_ARM_MOVW_ABS_NC] = ELF_RELOCATE_MOVW,
+        [R_ARM_MOVT_ABS] = ELF_RELOCATE_MOVT,
+        [R_ARM_THM_MOVW_ABS_NC] = ELF_RELOCATE_THM_MOVW,
+        [R_ARM_THM_MOVT_ABS] = ELF_RELOCATE_THM_MOVT,
+};
+
+//Entry at pos, or NULL when no complete entry is left
+static inline const SceReloc *entryAt(const void *reloc, SceUInt pos, SceUInt size)
+{
+        const SceReloc *entry = (const SceReloc *)((const SceUInt8 *)reloc + pos);
+
+        if (pos + 8 > size || (!SCE_RELOC_IS_SHORT (*entry) && pos + 12 > size))
+                return NULL;
+        return entry;
+}
+
+//Returns the class of the entry and advances pos past it
+static inline SceUInt decodeEntry(const SceReloc *entry, SceUInt *pos, const Elf32_Phdr *segs, SceUInt count,
+                                  SceUInt *datseg, elf_relocate_entry *decoded)
+{
+        SceUInt r_code, r_symseg, r_addend;
+
+        if (SCE_RELOC_IS_SHORT (*entry))
+        {
+                decoded->offset = SCE_RELOC_SHORT_OFFSET (entry->r_short);
+                r_addend = SCE_RELOC_SHORT_ADDEND (entry->r_short);
+                *pos += 8;
+        }
+        else
+        {
+                decoded->offset = SCE_RELOC_LONG_OFFSET (entry->r_long);
+                r_addend = SCE_RELOC_LONG_ADDEND (entry->r_long);
+                *pos += 12;
+        }
+
+        r_code = SCE_RELOC_CODE (*entry);
+        r_symseg = SCE_RELOC_SYMSEG (*entry);
+        *datseg = SCE_RELOC_DATSEG (*entry);
+        if (*datseg >= count || (r_symseg != ELF_RELOCATE_SYMSEG_NONE && r_symseg >= count))
+                return ELF_RELOCATE_UNKNOWN;
+
+        decoded->value = r_addend + (r_symseg == ELF_RELOCATE_SYMSEG_NONE ? 0 : (SceUInt)segs[r_symseg].p_vaddr);
+        return r_code < sizeof(elfRelocateClasses) ? elfRelocateClasses[r_code] : ELF_RELOCATE_UNKNOWN;
+}
+
+//Drops the entries past the loaded part of the segment, returns how many are left
+static SceUInt dropOverflows(elf_relocate_entry *entries, SceUInt n, SceUInt filesz)
+{
+        SceUInt kept = 0;
+
+        for (SceUInt i = 0; i < n; i++) {
+                if (filesz < 4 || entries[i].offset > filesz - 4) {
+                        DEBUG_LOG ("Relocation overflow detected at 0x%08X", entries[i].offset);
+                        continue;
+                }
+                entries[kept++] = entries[i];
+        }
+        return kept;
+}
+
+//Relocated words and halfwords are not always aligned, the copies compile to the widest access the target allows
+static inline SceUInt readWord(SceUInt loc)
+{
+        SceUInt word;
+
+        __builtin_memcpy(&word, (const void *)loc, sizeof(word));
+        return word;
+}
+
+static inline void writeWord(SceUInt loc, SceUInt word)
+{
+        __builtin_memcpy((void *)loc, &word, sizeof(word));
+}
+
+static inline SceUInt readHalf(SceUInt loc)
+{
+        SceUInt16 half;
+
+        __builtin_memcpy(&half, (const void *)loc, sizeof(half));
+        return half;
+}
+
+static inline void writeHalf(SceUInt loc, SceUInt half)
+{
+        SceUInt16 value = (SceUInt16)half;
+
+        __builtin_memcpy((void *)loc, &value, sizeof(value));
+}
+
+/*
+ * The loops below run once per group, after the whole group was checked against the segment.
+ * loc is the address the instruction runs at, which is also where it is written.
+ */
+static SceUInt applyGroup(SceUInt class, SceUInt base, const elf_relocate_entry *entries, SceUInt n)
+{
+        SceUInt loc, value, upper, lower, sign, j1, j2, applied = 0;
+        SceInt offset;
+        SceUInt i;
+
+        switch (class)
+        {
+        case ELF_RELOCATE_ABS32:
+                for (i = 0; i < n; i++)
+                        writeWord(base + entries[i].offset, entries[i].value);
+                return n;
+        case ELF_RELOCATE_REL32:
+                for (i = 0; i < n; i++) {
+                        loc = base + entries[i].offset;
+                        writeWord(loc, entries[i].value - loc);
+                }
+                return n;
+        case ELF_RELOCATE_PREL31:
+                for (i = 0; i < n; i++) {
+                        loc = base + entries[i].offset;
+                        writeWord(loc, (entries[i].value - loc) & 0x7fffffff);
+                }
+                return n;
+        case ELF_RELOCATE_V4BX:
+                //Preserve Rm and the condition code, the rest becomes MOV PC,Rm
+                for (i = 0; i < n; i++) {
+                        loc = base + entries[i].offset;
+                        writeWord(loc, (readWord(loc) & 0xf000000f) | 0x01a0f000);
+                }
+                return n;
+        case ELF_RELOCATE_ARM_BRANCH:
+                for (i = 0; i < n; i++) {
+                        loc = base + entries[i].offset;
+                        offset = entries[i].value - loc;
+                        if (offset <= (SceInt)0xfe000000 || offset >= (SceInt)0x02000000) {
+                                DEBUG_LOG ("Branch relocation out of range at 0x%08X", loc);
+                                continue;
+                        }
+                        writeWord(loc, (readWord(loc) & 0xff000000) | ((offset >> 2) & 0x00ffffff));
+                        applied++;
+                }
+                return applied;
+        case ELF_RELOCATE_MOVW:
+        case ELF_RELOCATE_MOVT:
+                for (i = 0; i < n; i++) {
+                        loc = base + entries[i].offset;
+                        value = class == ELF_RELOCATE_MOVT ? entries[i].value >> 16 : entries[i].value;
+                        writeWord(loc, (readWord(loc) & 0xfff0f000) | ((value & 0xf000) << 4) | (value & 0x0fff));
+                }
+                return n;
+        case ELF_RELOCATE_THM_CALL:
+                /*
+                 * 25 bit signed address range (Thumb-2 BL and B.W instructions):
+                 *   S:I1:I2:imm10:imm11:0
+                 * where:
+                 *   S     = upper[10]   = offset[24]
+                 *   I1    = ~(J1 ^ S)   = offset[23]
+                 *   I2    = ~(J2 ^ S)   = offset[22]
+                 *   imm10 = upper[9:0]  = offset[21:12]
+                 *   imm11 = lower[10:0] = offset[11:1]
+                 *   J1    = lower[13]
+                 *   J2    = lower[11]
+                 */
+                for (i = 0; i < n; i++) {
+                        loc = base + entries[i].offset;
+                        offset = entries[i].value - loc;
+                        if (offset <= (SceInt)0xff000000 || offset >= (SceInt)0x01000000) {
+                                DEBUG_LOG ("Branch relocation out of range at 0x%08X", loc);
+                                continue;
+                        }
+
+                        sign = (offset >> 24) & 1;
+                        j1 = sign ^ (~(offset >> 23) & 1);
+                        j2 = sign ^ (~(offset >> 22) & 1);
+                        writeHalf(loc, (readHalf(loc) & 0xf800) | (sign << 10) | ((offset >> 12) & 0x03ff));
+                        writeHalf(loc + 2, (readHalf(loc + 2) & 0xd000) | (j1 << 13) | (j2 << 11) | ((offset >> 1) & 0x07ff));
+                        applied++;
+                }
+                return applied;
+        case ELF_RELOCATE_THM_MOVW:
+        case ELF_RELOCATE_THM_MOVT:
+                /*
+                 * MOVT/MOVW instructions encoding in Thumb-2:
+                 *
+                 * i    = upper[10]
+                 * imm4 = upper[3:0]
+                 * imm3 = lower[14:12]
+                 * imm8 = lower[7:0]
+                 *
+                 * imm16 = imm4:i:imm3:imm8
+                 */
+                for (i = 0; i < n; i++) {
+                        loc = base + entries[i].offset;
+                        value = class == ELF_RELOCATE_THM_MOVT ? entries[i].value >> 16 : entries[i].value;
+                        upper = readHalf(loc);
+                        lower = readHalf(loc + 2);
+                        writeHalf(loc, (upper & 0xfbf0) | ((value & 0xf000) >> 12) | ((value & 0x0800) >> 1));
+                        writeHalf(loc + 2, (lower & 0x8f00) | ((value & 0x0700) << 4) | (value & 0x00ff));
+                }
+                return n;
+        default:
+                return 0;
+        }
+}
+
+/*
+ * Sorts the entries into groups of the same class and target segment, then relocates each group
+ * in its own loop. Entries relocating the same bytes are thus applied in group order rather than
+ * in file order, which toolchains never emit. scratch holds ELF_RELOCATE_SCRATCH_ENTRIES(size) entries.
+ * Writes to executable segments have to happen inside a patch session. Returns the number of
+ * relocations applied.
+ */
+int elf_relocate_apply(const void *reloc, SceUInt size, const Elf32_Phdr *segs, SceUInt count, elf_relocate_entry *scratch)
+{
+        SceUInt first[ELF_RELOCATE_GROUPS + 1], next[ELF_RELOCATE_GROUPS], last[ELF_RELOCATE_GROUPS];
+        const SceReloc *entry;
+        elf_relocate_entry decoded;
+        SceUInt pos, class, datseg, group, n;
+        int applied = 0;
+
+        for (group = 0; group < ELF_RELOCATE_GROUPS; group++) {
+                first[group + 1] = 0;
+                last[group] = 0;
+        }
+        first[0] = 0;
+
+        //First pass counts the groups and finds how far into its segment each one reaches
+        pos = 0;
+        while ((entry = entryAt(reloc, pos, size)) != NULL)
+        {
+                if (!SCE_RELOC_IS_SHORT (*entry) && SCE_RELOC_LONG_CODE2 (entry->r_long))
+                        DEBUG_LOG ("Code2 ignored for relocation at %X.", pos);
+
+                class = decodeEntry(entry, &pos, segs, count, &datseg, &decoded);
+                if (class == ELF_RELOCATE_UNKNOWN) {
+                        DEBUG_LOG ("Unknown relocation code %u in segment %u", SCE_RELOC_CODE (*entry), datseg);
+                        continue;
+                }
+                if (class < ELF_RELOCATE_FIRST_GROUPED)
+                        continue;
+
+                group = (class - ELF_RELOCATE_FIRST_GROUPED) * ELF_RELOCATE_MAX_SEGMENTS + datseg;
+                first[group + 1]++;
+                if (decoded.offset > last[group]) last[group] = decoded.offset;
+        }
+
+        for (group = 0; group < ELF_RELOCATE_GROUPS; group++) {
+                first[group + 1] += first[group];
+                next[group] = first[group];
+        }
+
+        //Second pass places each entry in its group
+        pos = 0;
+        while ((entry = entryAt(reloc, pos, size)) != NULL)
+        {
+                class = decodeEntry(entry, &pos, segs, count, &datseg, &decoded);
+                if (class < ELF_RELOCATE_FIRST_GROUPED)
+                        continue;
+
+                group = (class - ELF_RELOCATE_FIRST_GROUPED) * ELF_RELOCATE_MAX_SEGMENTS + datseg;
+                scratch[next[group]++] = decoded;
+        }
+
+        for (group = 0; group < ELF_RELOCATE_GROUPS; group++)
+        {
+                n = first[group + 1] - first[group];
+                if (n == 0)
+                        continue;
+
+                class = group / ELF_RELOCATE_MAX_SEGMENTS + ELF_RELOCATE_FIRST_GROUPED;
+                datseg = group % ELF_RELOCATE_MAX_SEGMENTS;
+
+                //A single check covers the group, only a group reaching too far is checked entry by entry
+                if (segs[datseg].p_filesz < 4 || last[group] > segs[datseg].p_filesz - 4)
+                        n = dropOverflows(&scratch[first[group]], n, segs[datseg].p_filesz);
+
+                applied += applyGroup(class, (SceUInt)segs[datseg].p_vaddr, &scratch[first[group]], n);
+        }
+
+        return applied;
+}
@@ -0,0 +1,57 @@
+/*
+elf_relocate.h : Applies SCE relocations grouped by type and target segment
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef VHL_ELF_RELOCATE_H
+#define VHL_ELF_RELOCATE_H
+
+#include "elf_headers.h"
+
+#define ELF_RELOCATE_MAX_SEGMENTS 16    //Segment fields of the entries are 4 bits
+#define ELF_RELOCATE_SYMSEG_NONE 15     //Symbol segment of the entries relative to 0
+
+//Relocation codes sharing a loop
+enum {
+        ELF_RELOCATE_UNKNOWN,
+        ELF_RELOCATE_NONE,
+        ELF_RELOCATE_ABS32,             //ABS32 and TARGET1
+        ELF_RELOCATE_REL32,             //REL32 and TARGET2
+        ELF_RELOCATE_PREL31,
+        ELF_RELOCATE_V4BX,
+        ELF_RELOCATE_ARM_BRANCH,        //CALL and JUMP24
+        ELF_RELOCATE_MOVW,
+        ELF_RELOCATE_MOVT,
+        ELF_RELOCATE_THM_CALL,
+        ELF_RELOCATE_THM_MOVW,
+        ELF_RELOCATE_THM_MOVT,
+        ELF_RELOCATE_CLASSES
+};
+
+#define ELF_RELOCATE_FIRST_GROUPED ELF_RELOCATE_ABS32
+#define ELF_RELOCATE_GROUPS ((ELF_RELOCATE_CLASSES - ELF_RELOCATE_FIRST_GROUPED) * ELF_RELOCATE_MAX_SEGMENTS)
+
+typedef struct {
+        SceUInt offset;                 //In the target segment
+        SceUInt value;                  //Symbol address plus addend
+} elf_relocate_entry;
+
+//Entries of size bytes of relocations need at most this many scratch entries
+#define ELF_RELOCATE_SCRATCH_ENTRIES(size) ((size) / 8)
+
+int elf_relocate_apply(const void *reloc, SceUInt size, const Elf32_Phdr *segs, SceUInt count, elf_relocate_entry *scratch);
+
+#endif
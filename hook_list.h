@@ -0,0 +1,35 @@
+/*
+hook_list.h : Hooks and exports provided by VHL, expanded by hooks.c and tools/hook_hash.c
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+//No include guard, define VHL_HOOK(nid_name, function) before including
+VHL_HOOK(sceAppMgrLoadExec, hook_sceAppMgrLoadExec)
+VHL_HOOK(sceIoOpen, hook_sceIoOpen)
+VHL_HOOK(sceIoRemove, hook_sceIoRemove)
+VHL_HOOK(sceIoDopen, hook_sceIoDopen)
+VHL_HOOK(sceIoMkdir, hook_sceIoMkdir)
+VHL_HOOK(sceIoRmdir, hook_sceIoRmdir)
+VHL_HOOK(sceIoGetstat, hook_sceIoGetstat)
+VHL_HOOK(sceIoChstat, hook_sceIoChstat)
+VHL_HOOK(printf, hook_printf)
+VHL_HOOK(puts, puts)
+VHL_HOOK(vhlGetIntValue, vhlGetIntValue)
+VHL_HOOK(vhlSetIntValue, vhlSetIntValue)
+VHL_HOOK(vhlGetNidStorageStats, vhlGetNidStorageStats)
+VHL_HOOK(vhlDumpNidStorageStats, vhlDumpNidStorageStats)
+VHL_HOOK(vhlGetLoadReport, vhlGetLoadReport)
+VHL_HOOK(vhlDumpLoadReport, vhlDumpLoadReport)
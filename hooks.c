@@ -26,9 +26,6 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #include "loader.h"
 #include "state_machine.h"
 
-#define EXPORT(name) { NID_ ## name, name }
-#define HOOK(name) { NID_ ## name, hook_ ## name }
-
 static int hook_printf(const char* fmt, ...)
 {
   #ifndef NO_CONSOLE_OUT
@@ -51,17 +48,9 @@ typedef struct {
         void *p;
 } hook_t;
 
+//Looked up through the perfect hash generated from the same list
 hook_t forcedHooks[] = {
-        HOOK(sceAppMgrLoadExec),
-        HOOK(sceIoOpen),
-        HOOK(sceIoRemove),
-        HOOK(sceIoDopen),
-        HOOK(sceIoMkdir),
-        HOOK(sceIoRmdir),
-        HOOK(sceIoGetstat),
-        HOOK(sceIoChstat),
-        HOOK(printf),
-        { NID_puts, puts },
-        EXPORT(vhlGetIntValue),
-        EXPORT(vhlSetIntValue)
+#define VHL_HOOK(nid_name, function) { NID_ ## nid_name, function },
+#include "hook_list.h"
+#undef VHL_HOOK
 };
@@ -28,6 +28,7 @@ int hook_sceAppMgrLoadExec(const char *path)
 
         char tmp[MAX_PATH_LENGTH];
         char *p = TranslateVFS(tmp, path);
+        nid_table_refresh();            //Pick up the modules loaded by the previous homebrew
         int retVal = elf_parser_load(data, p, NULL);
         retVal = elf_parser_start(data, -1);
 
@@ -45,6 +46,7 @@ int loader_exitHomebrew(int errorCode)
 
         //Load the menu
         char tmp[MAX_PATH_LENGTH];
+        nid_table_refresh();
         int retVal = elf_parser_load(data, TranslateVFS(tmp, MENU_PATH), NULL);
         if (retVal == 0)
                 elf_parser_start(data, -1);
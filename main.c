@@ -62,7 +62,7 @@ _start(UVL_Context *ctx)
 
         libkernelBase.value.i = B_UNSET(libkernelBase.value.i, 0);
 
-        libkernelInfo = nid_table_findModuleInfo(libkernelBase.value.p, KERNEL_MODULE_SIZE, "SceLibKernel");
+        libkernelInfo = nid_table_findModuleInfoFromAnchor(libkernelBase.value.p, KERNEL_MODULE_SIZE, "SceLibKernel");
         if (libkernelInfo == NULL) {
                 DEBUG_LOG_("Failed to find the module information of SceLibKernel");
                 return -1;
@@ -94,8 +94,12 @@ _start(UVL_Context *ctx)
         globals = p;
         ctx->psvLockMem();
 
+        config_initialize();
+        vm_patch_initialize();
+
         DEBUG_LOG_("Initializing table");
-        nid_storage_initialize();
+        if (nid_storage_initialize() < 0)
+                return -1;
 
         DEBUG_LOG_("Searching and Adding stubs to table...");
         nid_table_addAllStubs();
@@ -104,22 +108,22 @@ _start(UVL_Context *ctx)
         nid_table_resolveVhlSecondaryImports(vhlPrimaryStubBtm, vhlSecondaryStubSize,
                                           libkernelInfo, cachedImports, ctx);
         ctx->psvFlushIcache(vhlPrimaryStubBtm, vhlSecondaryStubSize);
+        vm_patch_enableThreads();
 
         DEBUG_LOG_("Adding stubs to table with cache");
         if (nid_table_addNIDCacheToTable(cachedImports) < 0)
                 return -1;
 
-        DEBUG_LOG_("Adding hooks to table");
-        nid_table_addAllHooks();
+        DEBUG_LOG("Stubs analyzed from templates: %d, disassembled: %d",
+                  vhlGetIntValue(VARIABLE_STUB_TEMPLATE_HITS), vhlGetIntValue(VARIABLE_STUB_DISASSEMBLED));
 
-        //TODO find a way to free unused memory
+        DEBUG_LOG_("Freezing table");
+        nid_storage_freeze();
 
         block_manager_initialize();  //Initialize the elf block slots
 
         //TODO decide how to handle plugins
 
-        config_initialize();
-
         DEBUG_LOG_("Loading menu...");
 
         if(elf_parser_load(globals->allocatedBlocks, "pss0:/top/Documents/homebrew.self", NULL) < 0) {
@@ -0,0 +1,184 @@
+/*
+module_scan.c : Locates the module information of the loaded modules in parallel
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#include <psp2/kernel/sysmem.h>
+#include <psp2/kernel/threadmgr.h>
+#include "utils/bithacks.h"
+#include "module_scan.h"
+#include "nid_table.h"
+
+//Copied onto the stack of the worker by sceKernelStartThread
+typedef struct {
+        module_scan *scan;
+        const SceUID *uids;
+        unsigned int first;
+} module_scan_worker;
+
+//Function entries of the export tables, entries is NULL to only count them
+static SceUInt collectExports(const SceModuleInfo *mod_info, nidTable_entry *entries)
+{
+        SceUInt base = (SceUInt)mod_info - mod_info->ent_top + sizeof(SceModuleInfo);
+        SceUInt count = 0;
+
+        FOREACH_EXPORT(base, mod_info, exportTable)
+        {
+                for(int i = 0; i < exportTable->num_functions; i++, count++)
+                {
+                        if(entries == NULL) continue;
+
+                        entries[count].nid = exportTable->nid_table[i];
+                        entries[count].library = exportTable->module_nid;
+                        entries[count].type = ENTRY_TYPES_FUNCTION;
+                        entries[count].value.p = exportTable->entry_table[i];
+                }
+        }
+        return count;
+}
+
+//Worker n takes every NID_TABLE_SCAN_WORKERS-th module starting at n, so each entry has a single writer.
+//The exports of its modules go to a block owned by the worker, in the order of its modules.
+static void scanModules(module_scan *scan, const SceUID *uids, unsigned int first)
+{
+        SceUInt total = 0;
+        nidTable_entry *entries;
+        void *p;
+
+        scan->export_uids[first] = 0;
+        for(unsigned int i = first; i < scan->count; i += NID_TABLE_SCAN_WORKERS)
+        {
+                module_scan_entry *module = &scan->modules[i];
+
+                module->mod_info = NULL;
+                module->exports = NULL;
+                module->export_count = 0;
+                module->info.size = sizeof(module->info);
+                if(sceKernelGetModuleInfo(uids[i], &module->info) < 0) {
+                        DEBUG_LOG_("Failed to get module info... Skipping...");
+                        module->info.size = 0;
+                        continue;
+                }
+                module->mod_info = nid_table_findModuleInfo(module->info.segments[0].vaddr,
+                                                            module->info.segments[0].memsz,
+                                                            module->info.module_name);
+                if(module->mod_info != NULL) total += collectExports(module->mod_info, NULL);
+        }
+        if(total == 0) return;
+
+        scan->export_uids[first] = sceKernelAllocMemBlock("vhlModuleScanExports", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW,
+                                                          FOUR_KB_ALIGN(total * sizeof(nidTable_entry)), NULL);
+        if(scan->export_uids[first] < 0) {
+                DEBUG_LOG("Failed to allocate module scan exports 0x%08X", scan->export_uids[first]);
+                scan->export_uids[first] = 0;
+                return;
+        }
+        if(sceKernelGetMemBlockBase(scan->export_uids[first], &p) < 0) {
+                DEBUG_LOG_("Failed to retrieve module scan exports memory");
+                sceKernelFreeMemBlock(scan->export_uids[first]);
+                scan->export_uids[first] = 0;
+                return;
+        }
+
+        entries = p;
+        for(unsigned int i = first; i < scan->count; i += NID_TABLE_SCAN_WORKERS)
+        {
+                module_scan_entry *module = &scan->modules[i];
+
+                if(module->mod_info == NULL) continue;
+
+                module->exports = entries;
+                module->export_count = collectExports(module->mod_info, entries);
+                entries += module->export_count;
+        }
+}
+
+static int scanThread(SceSize args __attribute__((unused)), void *argp)
+{
+        const module_scan_worker *worker = argp;
+
+        scanModules(worker->scan, worker->uids, worker->first);
+        return 0;
+}
+
+int module_scan_run(module_scan *scan, const SceUID *uids, unsigned int count)
+{
+        SceUID threads[NID_TABLE_SCAN_WORKERS];
+        module_scan_worker worker;
+        void *p;
+
+        scan->modules = NULL;
+        scan->count = count;
+        for(unsigned int n = 0; n < NID_TABLE_SCAN_WORKERS; n++)
+                scan->export_uids[n] = 0;
+        scan->uid = sceKernelAllocMemBlock("vhlModuleScan", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW,
+                                           FOUR_KB_ALIGN(count * sizeof(module_scan_entry)), NULL);
+        if(scan->uid < 0) {
+                DEBUG_LOG("Failed to allocate module scan 0x%08X", scan->uid);
+                scan->uid = 0;
+                return -1;
+        }
+        if(sceKernelGetMemBlockBase(scan->uid, &p) < 0) {
+                DEBUG_LOG_("Failed to retrieve module scan memory");
+                module_scan_free(scan);
+                return -1;
+        }
+        scan->modules = p;
+
+        worker.scan = scan;
+        worker.uids = uids;
+        for(unsigned int n = 1; n < NID_TABLE_SCAN_WORKERS; n++)
+        {
+                worker.first = n;
+                threads[n] = sceKernelCreateThread("vhlModuleScan", scanThread, MODULE_SCAN_PRIORITY,
+                                                   MODULE_SCAN_STACK_SIZE, 0, MODULE_SCAN_CPU_MASK_USER_0 << n, NULL);
+                if(threads[n] < 0) {
+                        DEBUG_LOG("Failed to create module scan worker 0x%08X", threads[n]);
+                        continue;
+                }
+                if(sceKernelStartThread(threads[n], sizeof(worker), &worker) < 0) {
+                        DEBUG_LOG_("Failed to start module scan worker");
+                        sceKernelDeleteThread(threads[n]);
+                        threads[n] = -1;
+                }
+        }
+
+        //This thread is the first worker, and takes over the share of the workers that did not start
+        scanModules(scan, uids, 0);
+        for(unsigned int n = 1; n < NID_TABLE_SCAN_WORKERS; n++)
+        {
+                if(threads[n] < 0) {
+                        scanModules(scan, uids, n);
+                        continue;
+                }
+                sceKernelWaitThreadEnd(threads[n], NULL, NULL);
+                sceKernelDeleteThread(threads[n]);
+        }
+        return 0;
+}
+
+void module_scan_free(module_scan *scan)
+{
+        for(unsigned int n = 0; n < NID_TABLE_SCAN_WORKERS; n++)
+        {
+                if(scan->export_uids[n] != 0) sceKernelFreeMemBlock(scan->export_uids[n]);
+                scan->export_uids[n] = 0;
+        }
+        if(scan->uid != 0) sceKernelFreeMemBlock(scan->uid);
+        scan->uid = 0;
+        scan->modules = NULL;
+        scan->count = 0;
+}
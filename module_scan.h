@@ -0,0 +1,73 @@
+/*
+module_scan.h : Locates the module information of the loaded modules in parallel
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef VHL_MODULE_SCAN_H
+#define VHL_MODULE_SCAN_H
+
+#include <psp2/types.h>
+#include <psp2/kernel/modulemgr.h>
+#include "module_headers.h"
+#include "config.h"
+#include "utils/nid_storage.h"
+
+#define MODULE_SCAN_STACK_SIZE 0x2000
+#define MODULE_SCAN_PRIORITY 0x10000100         //Default priority of user threads
+#define MODULE_SCAN_CPU_MASK_USER_0 0x10000     //Affinity of the first user core, the next ones follow
+#define MODULE_SCAN_MAX_LIBRARIES 16
+
+typedef struct {
+        Psp2LoadedModuleInfo info;              //size is 0 when the module information could not be retrieved
+        SceModuleInfo *mod_info;                //NULL when the module could not be scanned
+        const nidTable_entry *exports;          //NULL when the worker had no memory for them, they are walked again then
+        SceUInt export_count;
+} module_scan_entry;
+
+//Results are indexed like the module list, whichever worker produced them.
+//The exports of each worker live in a block of its own.
+typedef struct {
+        SceUID uid;
+        module_scan_entry *modules;
+        unsigned int count;
+        SceUID export_uids[NID_TABLE_SCAN_WORKERS];
+} module_scan;
+
+//Module whose NIDs are in the NID storage, the segment tells apart a module reusing the UID of an unloaded one
+typedef struct {
+        SceUID uid;
+        void *base;
+        SceUInt size;
+        SceUInt library_count;
+        SceNID libraries[MODULE_SCAN_MAX_LIBRARIES];    //Exported libraries, retired when the module goes away
+} module_scan_record;
+
+typedef struct {
+        module_scan_record modules[NID_TABLE_MAX_MODULES];
+        SceUInt count;
+} module_scan_set;
+
+//Memo of nid_table_findModuleInfo, direct mapped by the searched location
+typedef struct {
+        void *location;
+        SceUInt size;
+        SceModuleInfo *mod_info;
+} module_scan_located;
+
+int module_scan_run(module_scan *scan, const SceUID *uids, unsigned int count);
+void module_scan_free(module_scan *scan);
+
+#endif
@@ -0,0 +1,334 @@
+/*
+nid_db.c : Persists the NIDs recovered from loaded modules across boots
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#include <psp2/kernel/sysmem.h>
+#include <psp2/io/fcntl.h>
+#include <psp2/io/stat.h>
+#include "utils/bithacks.h"
+#include "utils/utils.h"
+#include "nid_db.h"
+#include "vhl.h"
+
+#define NID_DB_SEGMENT_COUNT (sizeof(((Psp2LoadedModuleInfo *)0)->segments) / sizeof(Psp2SegmentInfo))
+
+static SceNID* nid_db_nids(nid_db_module *module)
+{
+        return (SceNID*)(module + 1);
+}
+
+static nid_db_module* nid_db_nextModule(nid_db_module *module)
+{
+        return (nid_db_module*)(nid_db_nids(module) + module->nid_count);
+}
+
+static SceUInt nid_db_moduleSize(const Psp2LoadedModuleInfo *target)
+{
+        SceUInt size = 0;
+
+        for(unsigned int i = 0; i < NID_DB_SEGMENT_COUNT; i++)
+                size += target->segments[i].memsz;
+
+        return size;
+}
+
+//Everything that has to match for the stored NIDs to line up with the stubs of the loaded module.
+//Placement is left out, the values are always read from the module itself.
+static SceUInt nid_db_identity(const Psp2LoadedModuleInfo *target, const SceModuleInfo *mod_info, SceUInt *nidCount)
+{
+        SceUInt hash = HASH_FNV1A_INIT;
+        uintptr_t base = (uintptr_t)mod_info - mod_info->ent_top + sizeof(SceModuleInfo);
+        SceUInt counts[3];
+
+        for(unsigned int i = 0; i < NID_DB_SEGMENT_COUNT; i++)
+                hash = hash_fnv1a(hash, &target->segments[i].memsz, sizeof(target->segments[i].memsz));
+
+        FOREACH_EXPORT(base, mod_info, exportTable)
+        {
+                hash = hash_fnv1a(hash, &exportTable->module_nid, sizeof(exportTable->module_nid));
+                hash = hash_fnv1a(hash, exportTable->nid_table, exportTable->num_functions * sizeof(SceNID));
+        }
+
+        *nidCount = 0;
+        FOREACH_IMPORT((uintptr_t)target->segments[0].vaddr, mod_info, importTable)
+        {
+                counts[0] = importTable->size;
+                counts[1] = GET_FUNCTION_COUNT(importTable);
+                counts[2] = GET_VARIABLE_COUNT(importTable);
+                hash = hash_fnv1a(hash, counts, sizeof(counts));
+
+                *nidCount += 1 + counts[1] + counts[2];
+        }
+
+        return hash;
+}
+
+static int nid_db_isValid(nid_db_header *db, int len)
+{
+        nid_db_module *module = (nid_db_module*)(db + 1);
+        uintptr_t end = (uintptr_t)db + len;
+
+        if(len < (int)sizeof(nid_db_header) || db->magic != NID_DB_MAGIC ||
+           db->version != NID_DB_VERSION || db->size != (SceUInt)len)
+                return 0;
+
+        for(SceUInt i = 0; i < db->module_count; i++)
+        {
+                if((uintptr_t)(module + 1) > end || module->nid_count > NID_DB_MAX_NIDS)
+                        return 0;
+                module = nid_db_nextModule(module);
+        }
+        return (uintptr_t)module == end;
+}
+
+static void nid_db_release(nid_db_state *db)
+{
+        sceKernelFreeMemBlock(db->uid);
+        db->uid = 0;
+        db->in = NULL;
+        db->out = NULL;
+        db->in_next = NULL;
+        db->current = NULL;
+}
+
+int nid_db_open()
+{
+        nid_db_state *db = &getGlobals()->nid_db;
+        void *p;
+        SceUID fd;
+        int len;
+
+        db->in = NULL;
+        db->out = NULL;
+        db->in_next = NULL;
+        db->current = NULL;
+        db->dirty = 0;
+        db->refresh = 0;
+
+        //One half receives the stored database, the other one the database rebuilt during this boot
+        db->uid = sceKernelAllocMemBlock("vhlNidDb", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, FOUR_KB_ALIGN(2 * NID_DB_MAX_SIZE), NULL);
+        if(db->uid < 0) {
+                DEBUG_LOG("Failed to allocate NID database 0x%08X", db->uid);
+                db->uid = 0;
+                return -1;
+        }
+        if(sceKernelGetMemBlockBase(db->uid, &p) < 0) {
+                DEBUG_LOG_("Failed to retrieve NID database memory");
+                nid_db_release(db);
+                return -1;
+        }
+
+        db->out = (nid_db_header*)((uintptr_t)p + NID_DB_MAX_SIZE);
+        db->out->magic = NID_DB_MAGIC;
+        db->out->version = NID_DB_VERSION;
+        db->out->size = sizeof(nid_db_header);
+        db->out->module_count = 0;
+
+        fd = sceIoOpen(NID_STORAGE_CACHE_FILE, PSP2_O_RDONLY, 0777);
+        if(fd < 0) {
+                DEBUG_LOG_("No NID database, all modules will be scanned");
+                db->dirty = 1;
+                return 0;
+        }
+        len = sceIoRead(fd, p, NID_DB_MAX_SIZE);
+        sceIoClose(fd);
+
+        if(!nid_db_isValid(p, len)) {
+                DEBUG_LOG_("Discarding stale NID database");
+                db->dirty = 1;
+                return 0;
+        }
+        db->in = p;
+        db->in_next = (nid_db_module*)(db->in + 1);
+
+        return 0;
+}
+
+//Opens the database for the modules loaded after the boot. The stored records are all kept, so
+//the records of the modules the boot scanned stay and the new modules are added to them.
+int nid_db_reopen()
+{
+        nid_db_state *db = &getGlobals()->nid_db;
+
+        if(nid_db_open() < 0) return -1;
+
+        db->refresh = 1;
+        if(db->in != NULL) memcpy(db->out, db->in, db->in->size);
+        return 0;
+}
+
+static int nid_db_append(nid_db_state *db, const void *data, SceUInt len)
+{
+        if(db->out->size + len > NID_DB_MAX_SIZE) {
+                DEBUG_LOG_("NID database full, it will not be saved");
+                db->out = NULL;
+                return -1;
+        }
+        memcpy((char*)db->out + db->out->size, data, len);
+        db->out->size += len;
+        return 0;
+}
+
+//Record of the database matching key, searched from start on and wrapping around. A module may have
+//several records under its name, the ones of the versions that were loaded after the boot.
+static nid_db_module* nid_db_find(nid_db_header *db, nid_db_module *start, const nid_db_module *key)
+{
+        nid_db_module *first = (nid_db_module*)(db + 1);
+        nid_db_module *end = (nid_db_module*)((uintptr_t)db + db->size);
+        nid_db_module *module;
+
+        if(db->module_count == 0) return NULL;
+        if(start >= end) start = first;
+
+        module = start;
+        do {
+                if(memcmp(module->name, key->name, sizeof(module->name)) == 0 && module->size == key->size &&
+                   module->identity == key->identity && module->nid_count == key->nid_count)
+                        return module;
+
+                module = nid_db_nextModule(module);
+                if(module >= end) module = first;
+        } while(module != start);
+
+        return NULL;
+}
+
+//Returns the NIDs recorded for the module, which is then kept in the new database
+const SceNID* nid_db_restoreModule(const Psp2LoadedModuleInfo *target, const SceModuleInfo *mod_info)
+{
+        nid_db_state *db = &getGlobals()->nid_db;
+        nid_db_module key, *module, *copy;
+        SceUInt len;
+
+        db->current = NULL;
+        if(db->in == NULL) return NULL;
+
+        memcpy(key.name, target->module_name, sizeof(key.name));
+        key.size = nid_db_moduleSize(target);
+        key.identity = nid_db_identity(target, mod_info, &key.nid_count);
+
+        //Modules usually keep their order, the search starts at the record following the previous match
+        module = nid_db_find(db->in, db->in_next, &key);
+        if(module == NULL) return NULL;
+
+        //A refresh started from a copy of the stored records, which already holds this one
+        len = (uintptr_t)nid_db_nextModule(module) - (uintptr_t)module;
+        if(!db->refresh && db->out != NULL && nid_db_append(db, module, len) == 0) {
+                //The module is part of the boot now
+                copy = (nid_db_module*)((uintptr_t)db->out + db->out->size - len);
+                copy->flags = 0;
+                db->out->module_count++;
+        }
+
+        db->in_next = nid_db_nextModule(module);
+        return nid_db_nids(module);
+}
+
+void nid_db_beginModule(const Psp2LoadedModuleInfo *target, const SceModuleInfo *mod_info)
+{
+        nid_db_state *db = &getGlobals()->nid_db;
+        nid_db_module module;
+
+        db->dirty = 1;
+        db->current = NULL;
+        if(db->out == NULL) return;
+
+        memcpy(module.name, target->module_name, sizeof(module.name));
+        module.size = nid_db_moduleSize(target);
+        module.identity = nid_db_identity(target, mod_info, &module.nid_count);
+        module.flags = db->refresh ? NID_DB_MODULE_AFTER_BOOT : 0;
+        module.nid_count = 0;
+
+        if(nid_db_append(db, &module, sizeof(module)) < 0) return;
+
+        db->current = (nid_db_module*)((uintptr_t)db->out + db->out->size - sizeof(module));
+        db->out->module_count++;
+}
+
+void nid_db_addNids(const SceNID *nids, SceUInt count)
+{
+        nid_db_state *db = &getGlobals()->nid_db;
+
+        if(db->current == NULL) return;
+
+        if(nid_db_append(db, nids, count * sizeof(SceNID)) < 0) {
+                db->current = NULL;
+                return;
+        }
+        db->current->nid_count += count;
+}
+
+//Drops the record of a module whose NIDs could not be recovered completely
+void nid_db_abortModule()
+{
+        nid_db_state *db = &getGlobals()->nid_db;
+
+        if(db->current == NULL || db->out == NULL) return;
+
+        db->out->size = (uintptr_t)db->current - (uintptr_t)db->out;
+        db->out->module_count--;
+        db->current = NULL;
+}
+
+int nid_db_close()
+{
+        nid_db_state *db = &getGlobals()->nid_db;
+        SceUID fd;
+        int res = 0;
+
+        if(db->uid == 0) return -1;
+
+        //A module of the boot that went away requires a new database, the modules loaded after the boot are
+        //usually not there and their records are carried over as long as they fit
+        if(!db->refresh && db->in != NULL && db->out != NULL) {
+                nid_db_module *module = (nid_db_module*)(db->in + 1);
+
+                for(SceUInt i = 0; i < db->in->module_count; i++, module = nid_db_nextModule(module))
+                {
+                        SceUInt len = (uintptr_t)nid_db_nextModule(module) - (uintptr_t)module;
+
+                        if(nid_db_find(db->out, (nid_db_module*)(db->out + 1), module) != NULL) continue;
+
+                        if(!(module->flags & NID_DB_MODULE_AFTER_BOOT)) {
+                                db->dirty = 1;
+                        }else if(db->out->size + len <= NID_DB_MAX_SIZE) {
+                                memcpy((char*)db->out + db->out->size, module, len);
+                                db->out->size += len;
+                                db->out->module_count++;
+                        }
+                }
+        }
+
+        if(db->dirty && db->out != NULL) {
+                DEBUG_LOG_("Saving NID database");
+                sceIoMkdir(VHL_DATA_PATH, 0777);
+                fd = sceIoOpen(NID_STORAGE_CACHE_FILE, PSP2_O_WRONLY | PSP2_O_CREAT | PSP2_O_TRUNC, 0777);
+                if(fd < 0) {
+                        DEBUG_LOG("Failed to open NID database 0x%08X", fd);
+                        res = -1;
+                }else{
+                        if(sceIoWrite(fd, db->out, db->out->size) != (int)db->out->size) {
+                                DEBUG_LOG_("Failed to write NID database");
+                                res = -1;
+                        }
+                        sceIoClose(fd);
+                }
+        }
+
+        nid_db_release(db);
+        return res;
+}
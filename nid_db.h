@@ -0,0 +1,75 @@
+/*
+VHL: Vita Homebrew Loader
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef VHL_NID_DB_H
+#define VHL_NID_DB_H
+
+#include <psp2/types.h>
+#include <psp2/kernel/modulemgr.h>
+#include "utils/nid_storage.h"
+#include "module_headers.h"
+
+#define NID_DB_MAGIC 0x42444E56 //'VNDB'
+#define NID_DB_VERSION 4
+#define NID_DB_MAX_MODULES 256
+#define NID_DB_MAX_NIDS 32768
+
+#define NID_DB_MODULE_AFTER_BOOT 1      //Recorded by a refresh, kept by the boot even when the module is not loaded
+
+#define NID_DB_MAX_SIZE (sizeof(nid_db_header) + \
+                         NID_DB_MAX_MODULES * sizeof(nid_db_module) + \
+                         NID_DB_MAX_NIDS * sizeof(SceNID))
+
+//On-disk layout: a header followed by module_count module records,
+//each record being directly followed by its nid_count NIDs.
+//The NIDs are the ones the resolved stubs of the module overwrote: for every import table
+//its library NID, then its function NIDs and its variable NIDs, in the order of the tables.
+typedef struct {
+        SceUInt magic;
+        SceUInt version;
+        SceUInt size;           //Size of the whole database including this header
+        SceUInt module_count;
+} nid_db_header;
+
+typedef struct {
+        char name[28];
+        SceUInt size;           //Sum of the segment sizes
+        SceUInt identity;       //Exported NIDs and shape of the import tables, independent of where the module is loaded
+        SceUInt flags;          //NID_DB_MODULE_AFTER_BOOT
+        SceUInt nid_count;
+} nid_db_module;
+
+typedef struct {
+        SceUID uid;
+        nid_db_header *in;      //Database read from the memory card
+        nid_db_header *out;     //Database being rebuilt during this boot, or extended by a refresh
+        nid_db_module *in_next; //Record following the last restored module, modules usually keep their order
+        nid_db_module *current; //Record receiving the NIDs of the module being reloaded
+        int dirty;
+        int refresh;            //Opened after the boot, the stored records are all kept
+} nid_db_state;
+
+int nid_db_open(void);
+int nid_db_reopen(void);
+const SceNID* nid_db_restoreModule(const Psp2LoadedModuleInfo *target, const SceModuleInfo *mod_info);
+void nid_db_beginModule(const Psp2LoadedModuleInfo *target, const SceModuleInfo *mod_info);
+void nid_db_addNids(const SceNID *nids, SceUInt count);
+void nid_db_abortModule(void);
+int nid_db_close(void);
+
+#endif
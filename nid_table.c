@@ -20,13 +20,49 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #include <psp2/kernel/sysmem.h>
 #include <stdio.h>
 #include "hooks.c"
+#include "hook_hash.h"
 #include "nid_table.h"
+#include "stub.h"
+#include "module_scan.h"
+
+//Fails to compile when hook_hash.h was generated from another hook list
+typedef char hookHashIsCurrent[HOOK_HASH_COUNT == sizeof(forcedHooks) / sizeof(hook_t) ? 1 : -1];
+
+//Shapes of the stubs written by the system loader and by VHL, the immediates are masked out
+#define STUB_MOVW_R12 0xE300C000                //movw r12, #imm16
+#define STUB_MOVT_R12 0xE340C000                //movt r12, #imm16
+#define STUB_MOV_IMM16_MASK 0xFFF0F000
+#define STUB_BX_R12 0xE12FFF1C
+#define STUB_BX_LR 0xE12FFF1E
+#define STUB_SVC_0 0xEF000000
+#define STUB_MVN_R0 0xE3E00000                  //mvn r0, #0
+#define STUB_B 0xEA000000                       //b, the offset is masked out
+#define STUB_B_MASK 0xFF000000
+#define STUB_NOP 0xE320F000                     //nop
+
+#define STUB_IMM16(x) ((((x) >> 4) & 0xF000) | ((x) & 0x0FFF))
 
 static void resolveStubWithBranch(void *stub, const void *loc)
 {
         ARM_INSTRUCTION movt;
         ARM_INSTRUCTION movw;
         ARM_INSTRUCTION jmp;
+        SceInt offset = (SceInt)loc - ((SceInt)stub + 8);
+
+        //A single B reaches ARM code nearby, Thumb code needs the interworking of BX
+        if(B_EVEN((SceUInt)loc) && offset >= ARM_B_MIN_OFFSET && offset <= ARM_B_MAX_OFFSET) {
+                jmp.condition = ARM_CONDITION_ALWAYS;
+                jmp.type = ARM_B_INSTRUCTION;
+                jmp.instruction = ARM_INST_B;
+                jmp.argCount = 1;
+                jmp.value[0] = offset >> 2;
+
+                //The rest of the previous sequence is cleared so the stub keeps a single known shape
+                Assemble(&jmp, &((SceUInt*)stub)[0]);
+                ((SceUInt*)stub)[1] = STUB_NOP;
+                ((SceUInt*)stub)[2] = STUB_NOP;
+                return;
+        }
 
         movw.condition = ARM_CONDITION_ALWAYS;
         movw.type = ARM_MOV_INSTRUCTION;
@@ -105,12 +141,54 @@ static int resolveStubWithEntry(void *stub, const nidTable_entry *entry)
         return 0;
 }
 
-__attribute__((hot))
-int nid_table_analyzeStub(const void *stub, SceNID nid, nidTable_entry *entry)
+//Entries are gathered on the stack and handed over a table at a time
+typedef struct {
+        nidTable_entry entries[NID_STORAGE_BATCH_SIZE];
+        unsigned int count;
+} entry_batch;
+
+static void flushBatch(entry_batch *batch)
 {
-        entry->nid = nid;
-        entry->value.i = 0;
+        if(batch->count == 0) return;
+
+        nid_storage_addEntries(batch->entries, batch->count);
+        batch->count = 0;
+}
 
+//Slot for the next entry, which is only kept once count is incremented
+static nidTable_entry* nextBatchEntry(entry_batch *batch)
+{
+        if(batch->count == NID_STORAGE_BATCH_SIZE) flushBatch(batch);
+        return &batch->entries[batch->count];
+}
+
+static int matchStubTemplate(const SceUInt *words, nidTable_entry *entry)
+{
+        if(words[0] == STUB_MVN_R0) return ANALYZE_STUB_UNRESOLVED;
+        if((words[0] & STUB_B_MASK) == STUB_B && words[1] == STUB_NOP && words[2] == STUB_NOP) {
+                //Sign extend the word offset, which is relative to the instruction + 8
+                entry->type = ENTRY_TYPES_FUNCTION;
+                entry->value.i = (SceUInt)words + 8 + ((SceInt)(words[0] << 8) >> 6);
+                return ANALYZE_STUB_OK;
+        }
+        if((words[0] & STUB_MOV_IMM16_MASK) != STUB_MOVW_R12) return -1;
+
+        if((words[1] & STUB_MOV_IMM16_MASK) == STUB_MOVT_R12 && words[2] == STUB_BX_R12) {
+                entry->type = ENTRY_TYPES_FUNCTION;
+                entry->value.i = STUB_IMM16(words[0]) | STUB_IMM16(words[1]) << 16;
+                return ANALYZE_STUB_OK;
+        }
+        if(words[1] == STUB_SVC_0 && words[2] == STUB_BX_LR) {
+                entry->type = ENTRY_TYPES_SYSCALL;
+                entry->value.i = STUB_IMM16(words[0]);
+                return ANALYZE_STUB_OK;
+        }
+        return -1;
+}
+
+//Follows the instructions of a stub none of the templates matched
+static int disassembleStub(const void *stub, nidTable_entry *entry)
+{
         ARM_INSTRUCTION instr;
 
         while(1)
@@ -132,6 +210,12 @@ int nid_table_analyzeStub(const void *stub, SceNID nid, nidTable_entry *entry)
                                 entry->type = ENTRY_TYPES_FUNCTION;
                                 return ANALYZE_STUB_OK;
 
+                        case ARM_INST_B:
+                                //Sign extend the word offset, which is relative to the instruction + 8
+                                entry->value.i = (SceUInt)stub + 8 + ((SceInt)(instr.value[0] << 8) >> 6);
+                                entry->type = ENTRY_TYPES_FUNCTION;
+                                return ANALYZE_STUB_OK;
+
                         case ARM_INST_SVC:
                                 entry->type = ENTRY_TYPES_SYSCALL;
                                 return ANALYZE_STUB_OK;
@@ -140,13 +224,31 @@ int nid_table_analyzeStub(const void *stub, SceNID nid, nidTable_entry *entry)
                                 return ANALYZE_STUB_UNRESOLVED;
 
                         default:
-                                DEBUG_LOG_("ERROR");
                                 return ANALYZE_STUB_INVAL;
                 }
                 stub = (char*)stub + sizeof(SceUInt);
         }
 }
 
+__attribute__((hot))
+int nid_table_analyzeStub(const void *stub, SceNID nid, nidTable_entry *entry)
+{
+        //Also used to find SceLibKernel before the globals exist
+        globals_t *globals = getGlobals();
+        int res;
+
+        entry->nid = nid;
+        entry->value.i = 0;
+
+        res = matchStubTemplate(stub, entry);
+        if(globals != NULL) globals->intOptions[(res < 0 ? VARIABLE_STUB_DISASSEMBLED : VARIABLE_STUB_TEMPLATE_HITS) - 1]++;
+        if(res >= 0) return res;
+
+        res = disassembleStub(stub, entry);
+        if(res == ANALYZE_STUB_INVAL) DEBUG_LOG_("ERROR");
+        return res;
+}
+
 int nid_table_isValidModuleInfo(SceModuleInfo *m_info)
 {
         if(m_info == NULL) return 0; //Invalid if NULL
@@ -155,15 +257,137 @@ int nid_table_isValidModuleInfo(SceModuleInfo *m_info)
         return 1;
 }
 
+//Adds the resolved stubs of an import table of a loaded module, whose own NID tables were overwritten
+static void addImportTable(entry_batch *batch, SceModuleImports *importTable, SceNID library,
+                           const SceNID *functionNids, const SceNID *variableNids)
+{
+        nidTable_entry *entry;
+        void **entryTable = GET_FUNCTIONS_ENTRYTABLE(importTable);
+
+        for(unsigned int i = 0; i < GET_FUNCTION_COUNT(importTable); i++)
+        {
+                entry = nextBatchEntry(batch);
+                int err = nid_table_analyzeStub(entryTable[i], functionNids[i], entry);
+                entry->library = library;
+                if(err == ANALYZE_STUB_OK)
+                       batch->count++;
+                else if(err == ANALYZE_STUB_INVAL)
+                       break;
+        }
+
+        entryTable = GET_VARIABLE_ENTRYTABLE(importTable);
+
+        for(int i = 0; i < GET_VARIABLE_COUNT(importTable); i++)
+        {
+                entry = nextBatchEntry(batch);
+                entry->type = ENTRY_TYPES_VARIABLE;
+                entry->nid = variableNids[i];
+                entry->library = library;
+                entry->value.i = *(SceUInt*)entryTable[i];
+                batch->count++;
+        }
+        flushBatch(batch);
+}
+
+//Recovers the import NIDs from a second, unresolved copy of the module and records them in the NID database
+static int addImportsFromReload(entry_batch *batch, Psp2LoadedModuleInfo *target, SceModuleInfo *orig_mod_info)
+{
+        Psp2LoadedModuleInfo l_mod_info;
+
+        nid_db_beginModule(target, orig_mod_info);
+
+        int loadResult = sizeof(int);
+        SceUID l_mod_uid = sceKernelLoadModule(target->path,0,&loadResult);
+        if(l_mod_uid < 0) {
+                DEBUG_LOG_("Reload failed...");
+                nid_db_abortModule();
+                return -1;
+        }
+
+        l_mod_info.size = sizeof(Psp2LoadedModuleInfo);
+        if(sceKernelGetModuleInfo(l_mod_uid, &l_mod_info) < 0) {
+                DEBUG_LOG_("Failed to get module info...");
+                nid_db_abortModule();
+                return -1;
+        }
+
+
+        SceModuleInfo *mod_info = nid_table_findModuleInfo(l_mod_info.segments[0].vaddr, l_mod_info.segments[0].memsz, l_mod_info.module_name);
+
+        if(mod_info != NULL)
+        {
+                SceUInt base_orig = (SceUInt)target->segments[0].vaddr;
+
+                SceUInt base_l = (SceUInt)l_mod_info.segments[0].vaddr;
+                SceModuleImports *importTable_l = (SceModuleImports*)(base_l + mod_info->stub_top);
+
+                FOREACH_IMPORT(base_orig, orig_mod_info, importTable_orig)
+                {
+                        SceNID library = GET_NID(importTable_l);
+                        SceNID *functionNids = GET_FUNCTIONS_NIDTABLE(importTable_l);
+                        SceNID *variableNids = GET_VARIABLE_NIDTABLE(importTable_l);
+
+                        nid_db_addNids(&library, 1);
+                        nid_db_addNids(functionNids, GET_FUNCTION_COUNT(importTable_l));
+                        nid_db_addNids(variableNids, GET_VARIABLE_COUNT(importTable_l));
+
+                        addImportTable(batch, importTable_orig, library, functionNids, variableNids);
+
+                        importTable_l = GET_NEXT_IMPORT(importTable_l);
+                }
+                DEBUG_LOG_("NID cache updated");
+        }else{
+                nid_db_abortModule();
+        }
+
+        sceKernelUnloadModule(l_mod_uid);
+        return 0;
+}
+
+//Remembers the module and the libraries it exports so nid_table_refresh can tell when it goes away
+static void recordModule(SceUID uid, const Psp2LoadedModuleInfo *target, const SceModuleInfo *mod_info)
+{
+        module_scan_set *set = &getGlobals()->scanned_modules;
+        module_scan_record *record;
+        SceUInt base;
+
+        if(set->count == NID_TABLE_MAX_MODULES) {
+                DEBUG_LOG_("Too many scanned modules, the module will be scanned again");
+                return;
+        }
+        record = &set->modules[set->count++];
+        record->uid = uid;
+        record->base = target->segments[0].vaddr;
+        record->size = target->segments[0].memsz;
+        record->library_count = 0;
+        if(mod_info == NULL) return;
+
+        base = (SceUInt)mod_info - mod_info->ent_top + sizeof(SceModuleInfo);
+        FOREACH_EXPORT(base, mod_info, exportTable)
+        {
+                if(record->library_count == MODULE_SCAN_MAX_LIBRARIES) {
+                        DEBUG_LOG("Too many libraries in %s, they will not be retired", target->module_name);
+                        break;
+                }
+                record->libraries[record->library_count++] = exportTable->module_nid;
+        }
+}
+
+//exports holds the entries a scan worker built from the export tables, NULL to walk them here
 __attribute__((hot))
-int nid_table_addStubsInModule(Psp2LoadedModuleInfo *target)
+static int addStubsInScannedModule(Psp2LoadedModuleInfo *target, SceModuleInfo *orig_mod_info,
+                                   const nidTable_entry *exports, SceUInt exportCount)
 {
-        nidTable_entry entry;
-        DEBUG_LOG_("Searching for module info");
-        SceModuleInfo *orig_mod_info = nid_table_findModuleInfo(target->segments[0].vaddr, target->segments[0].memsz, target->module_name);
-        DEBUG_LOG_("Found");
-        if(orig_mod_info != NULL) {
+        entry_batch batch;
+        nidTable_entry *entry;
+        const SceNID *nids;
 
+        if(orig_mod_info == NULL) return 0;
+        batch.count = 0;
+
+        if(exports != NULL) {
+                nid_storage_addEntries(exports, exportCount);
+        }else{
                 //Build entries from export table
                 SceUInt base_orig = (SceUInt)orig_mod_info - orig_mod_info->ent_top + sizeof(SceModuleInfo);
                 SceModuleExports *exportTable_orig = (SceModuleExports*)(base_orig + orig_mod_info->ent_top);
@@ -172,94 +396,106 @@ int nid_table_addStubsInModule(Psp2LoadedModuleInfo *target)
                 {
                         for(int i = 0; i < exportTable_orig->num_functions; i++)
                         {
-                                entry.nid = exportTable_orig->nid_table[i];
-                                entry.type = ENTRY_TYPES_FUNCTION;
-                                entry.value.p = exportTable_orig->entry_table[i];
-                                nid_storage_addEntry(&entry);
+                                entry = nextBatchEntry(&batch);
+                                entry->nid = exportTable_orig->nid_table[i];
+                                entry->library = exportTable_orig->module_nid;
+                                entry->type = ENTRY_TYPES_FUNCTION;
+                                entry->value.p = exportTable_orig->entry_table[i];
+                                batch.count++;
                         }
+                        flushBatch(&batch);
                 }
-                DEBUG_LOG_("Exports resolved");
-                //NOTE: The problem is somewhere here
-
-                //Build entries from import table
+        }
+        DEBUG_LOG_("Exports resolved");
 
-                Psp2LoadedModuleInfo l_mod_info;
+        //Build entries from import table, the values come from the stubs of the loaded module
+        //and only the NIDs they overwrote have to be recovered
+        nids = nid_db_restoreModule(target, orig_mod_info);
+        if(nids == NULL)
+                return addImportsFromReload(&batch, target, orig_mod_info);
 
-                int loadResult = sizeof(int);
-                SceUID l_mod_uid = sceKernelLoadModule(target->path,0,&loadResult);
-                if(l_mod_uid < 0) {
-                        DEBUG_LOG_("Reload failed...");
-                        return -1;
-                }
+        FOREACH_IMPORT((SceUInt)target->segments[0].vaddr, orig_mod_info, importTable)
+        {
+                SceNID library = *nids++;
+                const SceNID *functionNids = nids;
+                nids += GET_FUNCTION_COUNT(importTable);
+                const SceNID *variableNids = nids;
+                nids += GET_VARIABLE_COUNT(importTable);
 
-                l_mod_info.size = sizeof(Psp2LoadedModuleInfo);
-                if(sceKernelGetModuleInfo(l_mod_uid, &l_mod_info) < 0) {
-                        DEBUG_LOG_("Failed to get module info...");
-                        return -1;
-                }
+                addImportTable(&batch, importTable, library, functionNids, variableNids);
+        }
+        DEBUG_LOG_("Imports restored from NID database");
+        return 0;
+}
 
+int nid_table_addStubsInModule(Psp2LoadedModuleInfo *target)
+{
+        DEBUG_LOG_("Searching for module info");
+        SceModuleInfo *orig_mod_info = nid_table_findModuleInfo(target->segments[0].vaddr, target->segments[0].memsz, target->module_name);
+        DEBUG_LOG_("Found");
+        return addStubsInScannedModule(target, orig_mod_info, NULL, 0);
+}
 
-                SceModuleInfo *mod_info = nid_table_findModuleInfo(l_mod_info.segments[0].vaddr, l_mod_info.segments[0].memsz, l_mod_info.module_name);
+//Offset between the addresses forcedHooks was linked with and the ones VHL runs at
+__attribute__((noinline))
+static uintptr_t hooksBias()
+{
+        uintptr_t top, tmp;
 
-                if(mod_info != NULL)
-                {
-                        SceUInt base_orig = (SceUInt)target->segments[0].vaddr;
+        __asm__ ("hooksBiasPc: mov %0, pc;"
+                 "ldr %1, =hooksBiasPc + 4;"
+                 "sub %0, %0, %1;"
+                 : "=r"(top), "=r"(tmp));
+        return top;
+}
 
-                        SceUInt base_l = (SceUInt)l_mod_info.segments[0].vaddr;
-                        SceModuleImports *importTable_l = (SceModuleImports*)(base_l + mod_info->stub_top);
+int nid_table_findHook(SceNID nid, nidTable_entry *entry)
+{
+        unsigned int index = hookHashSlots[(SceUInt)(nid * HOOK_HASH_MULTIPLIER) >> (32 - HOOK_HASH_BITS)];
 
-                        //Check the export tables to see if the NID is present
-                        //If so assign the respective pointer to functionPtrLocation
-                        FOREACH_IMPORT(base_orig, orig_mod_info, importTable_orig)
-                        {
-                                void **entryTable = GET_FUNCTIONS_ENTRYTABLE(importTable_orig);
-                                SceNID *nidTable = GET_FUNCTIONS_NIDTABLE(importTable_l);
-
-                                for(unsigned int i = 0; i < GET_FUNCTION_COUNT(importTable_orig); i++)
-                                {
-                                        int err = nid_table_analyzeStub(entryTable[i], nidTable[i], &entry);
-                                        if(err == ANALYZE_STUB_OK)
-                                               nid_storage_addEntry(&entry);
-                                        else if(err == ANALYZE_STUB_INVAL)
-                                               break;
-                                }
-
-                                entryTable = GET_VARIABLE_ENTRYTABLE(importTable_orig);
-                                nidTable = GET_VARIABLE_NIDTABLE(importTable_l);
-
-                                for(int i = 0; i < GET_VARIABLE_COUNT(importTable_orig); i++)
-                                {
-                                        entry.type = ENTRY_TYPES_VARIABLE;
-                                        entry.nid = nidTable[i];
-                                        entry.value.i = *(SceUInt*)entryTable[i];
-                                        nid_storage_addEntry(&entry);
-                                }
-
-                                importTable_l = GET_NEXT_IMPORT(importTable_l);
-                        }
-                        DEBUG_LOG_("NID cache updated");
-                }
+        if(index == 0 || forcedHooks[index - 1].nid != nid) return -1;
 
-                sceKernelUnloadModule(l_mod_uid);
-        }
+        entry->nid = nid;
+        entry->library = NID_STORAGE_LIBRARY_VHL;
+        entry->type = ENTRY_TYPES_FUNCTION;
+        entry->value.i = hooksBias() + (uintptr_t)forcedHooks[index - 1].p;
         return 0;
 }
 
-void nid_table_addAllHooks()
+static void addStubsInModules(const SceUID *uids, unsigned int count)
 {
-        nidTable_entry entry;
-        uintptr_t top;
-        unsigned int i;
+        Psp2LoadedModuleInfo loadedModuleInfo;
+        loadedModuleInfo.size = sizeof(loadedModuleInfo);
+        module_scan scan;
+
+        //The workers search the module information and build the export entries, which are then added in
+        //the order of the module list so overwrites match the serial walk. The imports stay on this thread:
+        //the NID database is rebuilt in that order, the reloads are serialized by the module manager anyway,
+        //and analyzing the stubs updates counters shared by the whole boot.
+        if(module_scan_run(&scan, uids, count) == 0) {
+                for(unsigned int i = 0; i < count; i++)
+                {
+                        module_scan_entry *module = &scan.modules[i];
 
-        __asm__ ("addAllHooksPc: mov %0, pc;"
-                 "ldr %1, =addAllHooksPc + 4;"
-                 "sub %0, %0, %1;"
-                 : "=r"(top), "=r"(i));
-        for (i = 0; i < sizeof(forcedHooks) / sizeof(hook_t); i++) {
-                entry.nid = forcedHooks[i].nid;
-                entry.type = ENTRY_TYPES_FUNCTION;
-                entry.value.i = top + (uintptr_t)forcedHooks[i].p;
-                nid_storage_addEntry(&entry);
+                        if(module->info.size == 0) continue;
+                        recordModule(uids[i], &module->info, module->mod_info);
+                        addStubsInScannedModule(&module->info, module->mod_info,
+                                                module->exports, module->export_count);
+                }
+                module_scan_free(&scan);
+                return;
+        }
+
+        for(unsigned int i = 0; i < count; i++)
+        {
+                if(sceKernelGetModuleInfo(uids[i], &loadedModuleInfo) < 0) {
+                        DEBUG_LOG_("Failed to get module info... Skipping...");
+                }else{
+                        DEBUG_LOG_("Mod info obtained");
+                        SceModuleInfo *mod_info = nid_table_findModuleInfo(loadedModuleInfo.segments[0].vaddr, loadedModuleInfo.segments[0].memsz, loadedModuleInfo.module_name);
+                        recordModule(uids[i], &loadedModuleInfo, mod_info);
+                        addStubsInScannedModule(&loadedModuleInfo, mod_info, NULL, 0);
+                }
         }
 }
 
@@ -273,55 +509,149 @@ int nid_table_addAllStubs()
                 DEBUG_LOG_("Failed to get module list... Exiting...");
                 return -1;
         }
-        Psp2LoadedModuleInfo loadedModuleInfo;
-        loadedModuleInfo.size = sizeof(loadedModuleInfo);
 
-        for(unsigned int i = 0; i < numEntries; i++)
+        getGlobals()->scanned_modules.count = 0;
+        memset(getGlobals()->located_modules, 0, sizeof(getGlobals()->located_modules));
+        nid_db_open();
+        addStubsInModules(uids, numEntries);
+        DEBUG_LOG_("All modules resolved");
+
+        nid_db_close();
+        return 0;
+}
+
+#define NID_TABLE_SCANNED_UID -1           //Module list slot of a module already scanned, UIDs are never negative
+
+//Scans the modules loaded since the last scan and drops the libraries of the ones that went away.
+//The NID database is opened again for the new modules, only the ones it has no record of are loaded
+//a second time through sceKernelLoadModule to recover the NIDs of their imports, and recorded for the
+//next refresh and the next boots. The modules already scanned cost one sceKernelGetModuleInfo.
+int nid_table_refresh()
+{
+        module_scan_set *set = &getGlobals()->scanned_modules;
+        module_scan_record *record;
+        SceUID uids[NID_TABLE_MAX_MODULES];
+        unsigned int numEntries = NID_TABLE_MAX_MODULES;
+        unsigned int i, j, kept = 0, retired = 0, fresh = 0;
+        Psp2LoadedModuleInfo info;
+
+        if(sceKernelGetModuleList(0xFF, uids, &numEntries) < 0) {
+                DEBUG_LOG_("Failed to get module list");
+                return -1;
+        }
+
+        info.size = sizeof(info);
+        for(i = 0; i < set->count; i++)
         {
-                if(sceKernelGetModuleInfo(uids[i], &loadedModuleInfo) < 0) {
-                        DEBUG_LOG_("Failed to get module info... Skipping...");
-                }else{
-                        DEBUG_LOG_("Mod info obtained");
-                        nid_table_addStubsInModule(&loadedModuleInfo);
+                record = &set->modules[i];
+                for(j = 0; j < numEntries && uids[j] != record->uid; j++);
+
+                if(j < numEntries && sceKernelGetModuleInfo(uids[j], &info) >= 0 &&
+                   info.segments[0].vaddr == record->base && info.segments[0].memsz == record->size) {
+                        uids[j] = NID_TABLE_SCANNED_UID;
+                        set->modules[kept++] = *record;
+                        continue;
                 }
+
+                for(j = 0; j < record->library_count; j++)
+                        nid_storage_removeLibrary(record->libraries[j]);
+                retired++;
         }
-        DEBUG_LOG_("All modules resolved");
-        return 0;
+        set->count = kept;
+
+        for(i = 0; i < numEntries; i++)
+                if(uids[i] != NID_TABLE_SCANNED_UID) uids[fresh++] = uids[i];
+
+        if(fresh > 0) {
+                nid_db_reopen();
+                addStubsInModules(uids, fresh);
+                nid_db_close();
+                nid_storage_freeze();
+        }
+        DEBUG_LOG("Module list refreshed, %d new and %d unloaded modules", fresh, retired);
+        return fresh + retired;
+}
+
+static int isModuleInfoOf(const SceModuleInfo *m_info, const char *libname, SceUInt nameLength)
+{
+        //The terminator is compared too unless the name fills the field
+        if(nameLength < sizeof(m_info->modname)) nameLength++;
+        else nameLength = sizeof(m_info->modname);
+
+        return nid_table_isValidModuleInfo((SceModuleInfo*)m_info) && memcmp(m_info->modname, libname, nameLength) == 0;
+}
+
+static module_scan_located* locatedModuleInfo(module_scan_located *located, const void *location)
+{
+        return &located[((SceUInt)location >> 12) * 2654435761U >> (32 - NID_TABLE_LOCATED_BITS)];
 }
 
 SceModuleInfo* nid_table_findModuleInfo(void* location, SceUInt size, char* libname)
 {
-        SceModuleInfo *moduleInfo = NULL;
-        void *origLocation = location;
-        //Find the module info string in this memory region
-        while(size > 0)
+        globals_t *globals = getGlobals();
+        module_scan_located *located = NULL;
+        SceUInt nameLength = strlen(libname);
+        const SceUInt *cur, *top;
+
+        //Workers share the memo, an entry is only trusted once it checks out against the memory it points to
+        if(globals != NULL) {
+                located = locatedModuleInfo(globals->located_modules, location);
+                if(located->location == location && located->size == size &&
+                   (SceUInt)located->mod_info - (SceUInt)location < size &&
+                   isModuleInfoOf(located->mod_info, libname, nameLength))
+                        return located->mod_info;
+        }
+
+        if(size < sizeof(SceModuleInfo)) return NULL;
+
+        //The structure is word aligned and starts with the expected attribute and version. The search goes
+        //backwards as the module information usually follows the code, at the end of the segment, so the
+        //bounds must be the ones of a mapped segment. Callers holding only an anchor use the forward search.
+        top = (const SceUInt*)(((SceUInt)location + 3) & ~3);
+        cur = (const SceUInt*)(((SceUInt)location + size - sizeof(SceModuleInfo)) & ~3);
+        for(; cur >= top; cur--)
         {
-                DEBUG_LOG_("test");
-                location = memstr(location, size, libname, strlen(libname));
-                if(location == NULL)
-                {
-                        DEBUG_LOG_("Failed to find module info");
-                        break;
-                }
+                if(*cur != NID_TABLE_MODULE_INFO_HEADER || !isModuleInfoOf((const SceModuleInfo*)cur, libname, nameLength))
+                        continue;
 
-                //Perform a detailed check to make sure this is a real match
-                moduleInfo = (SceModuleInfo*)((SceUInt)location - 4);
-                if(nid_table_isValidModuleInfo(moduleInfo)) break;
-                else {
-                        DEBUG_LOG_("False alarm...Continuing...");
-                        moduleInfo = NULL; //If check fails, this was a false positive and move on
-                        size -= ((SceUInt)location - (SceUInt)origLocation) + strlen(libname);
-                        location = (void*)(((SceUInt)location) + strlen(libname));
+                if(located != NULL) {
+                        located->location = location;
+                        located->size = size;
+                        located->mod_info = (SceModuleInfo*)cur;
                 }
+                return (SceModuleInfo*)cur;
+        }
+
+        DEBUG_LOG_("Failed to find module info");
+        return NULL;
+}
+
+//The size only bounds the search, the memory past the module information may not be mapped,
+//so the search goes forward from the anchor and stops at the first match
+SceModuleInfo* nid_table_findModuleInfoFromAnchor(void* anchor, SceUInt maxSize, char* libname)
+{
+        SceUInt nameLength = strlen(libname);
+        const SceUInt *cur, *end;
+
+        if(maxSize < sizeof(SceModuleInfo)) return NULL;
+
+        cur = (const SceUInt*)(((SceUInt)anchor + 3) & ~3);
+        end = (const SceUInt*)((SceUInt)anchor + maxSize - sizeof(SceModuleInfo));
+        for(; cur <= end; cur++)
+        {
+                if(*cur == NID_TABLE_MODULE_INFO_HEADER && isModuleInfoOf((const SceModuleInfo*)cur, libname, nameLength))
+                        return (SceModuleInfo*)cur;
         }
 
-        return moduleInfo;
+        DEBUG_LOG_("Failed to find module info");
+        return NULL;
 }
 
 __attribute__((hot))
 int nid_table_addNIDCacheToTable(const SceModuleImports * const cachedImports[CACHED_IMPORTED_MODULE_NUM])
 {
-        nidTable_entry entry;
+        entry_batch batch;
+        nidTable_entry *entry;
         NID_CACHE *importsInfo;
         SceNID *cachedNid;
         unsigned int index, offset, i;
@@ -329,12 +659,17 @@ int nid_table_addNIDCacheToTable(const SceModuleImports * const cachedImports[CA
         offset = 0;
         importsInfo = nidCache_getHeader();
         cachedNid = nidCache_getCache();
+        batch.count = 0;
         for (index = 0; index < CACHED_IMPORTED_MODULE_NUM; index++) {
                 for(i = 0; i < importsInfo[index].count; i++) {
-                        if(nid_table_analyzeStub(GET_FUNCTIONS_ENTRYTABLE(cachedImports[index])[i], cachedNid[offset], &entry) == ANALYZE_STUB_OK)
-                                nid_storage_addEntry(&entry);
+                        entry = nextBatchEntry(&batch);
+                        if(nid_table_analyzeStub(GET_FUNCTIONS_ENTRYTABLE(cachedImports[index])[i], cachedNid[offset], entry) == ANALYZE_STUB_OK) {
+                                entry->library = importsInfo[index].module_nid;
+                                batch.count++;
+                        }
                         offset++;
                 }
+                flushBatch(&batch);
         }
         return 0;
 }
@@ -349,8 +684,8 @@ static int resolveVhlImportWithTable(SceUInt *stub, const UVL_Context *ctx)
         nidTable_entry entry;
         int res;
 
-        //Check the cache if it's ready
-        res = nid_storage_getEntry(stub[3], &entry);
+        //Check the cache if it's ready, the stubs do not tell which library they import from
+        res = nid_storage_findEntry(stub[3], &entry);
         if (res == 0) {
                 ctx->psvUnlockMem();
                 resolveStubWithEntry(stub, &entry);
@@ -364,28 +699,17 @@ static int resolveVhlImportWithCache(SceUInt *stub,
         const SceModuleImports * const cachedImports[CACHED_IMPORTED_MODULE_NUM],
         const UVL_Context *ctx)
 {
-        unsigned int index, offset, i;
-        NID_CACHE *importsInfo;
-        SceNID *cachedNid;
+        const NID_CACHE_ENTRY *cached;
 
-        offset = 0;
-        importsInfo = nidCache_getHeader();
-        cachedNid = nidCache_getCache();
-        for (index = 0; index < CACHED_IMPORTED_MODULE_NUM; index++) {
-                for(i = 0; i < importsInfo[index].count; i++) {
-                        if (cachedNid[offset] == stub[3]) {
-                                ctx->psvUnlockMem();
-                                copyStub(stub, GET_FUNCTIONS_ENTRYTABLE(cachedImports[index])[i]);
-                                ctx->psvLockMem();
-
-                                return 0;
-                        }
+        cached = nidCache_find(stub[3]);
+        if (cached == NULL || cachedImports[cached->module] == NULL)
+                return -1;
 
-                        offset++;
-                }
-        }
+        ctx->psvUnlockMem();
+        copyStub(stub, GET_FUNCTIONS_ENTRYTABLE(cachedImports[cached->module])[cached->index]);
+        ctx->psvLockMem();
 
-        return -1;
+        return 0;
 }
 
 static int resolveVhlImportWithLibkernel(SceUInt *stub, const SceModuleInfo *moduleInfo,
@@ -485,20 +809,153 @@ void nid_table_resolveVhlSecondaryImports(void *p, size_t size, const SceModuleI
         }
 }
 
+//Returns where the entry was found, see RESOLVE_STUB_HOOK
+static int findStubEntry(SceNID library, SceNID nid, nidTable_entry *entry)
+{
+        int result, source;
+
+        //Hooks take precedence over the library, which is only left when the NID is exported elsewhere
+        source = RESOLVE_STUB_HOOK;
+        result = nid_table_findHook(nid, entry);
+        if(result < 0) {
+                result = nid_storage_getEntry(library, nid, entry);
+                source = result == NID_STORAGE_FROM_LOOKASIDE ? RESOLVE_STUB_LOOKASIDE : RESOLVE_STUB_TABLE;
+        }
+        if(result < 0) {
+                result = nid_storage_findEntry(nid, entry);
+                source = RESOLVE_STUB_OTHER_LIBRARY;
+        }
+        if(result < 0) {
+                DEBUG_LOG("Failed to find NID 0x%08x in library 0x%08x", nid, library);
+                return -1;
+        }
+        return source;
+}
+
+//Returns where the entry was found, see RESOLVE_STUB_HOOK
 __attribute__((hot))
-int nid_table_resolveStub(void *stub, SceNID nid)
+int nid_table_resolveStub(void *stub, SceNID library, SceNID nid)
 {
         nidTable_entry entry;
-        int result;
+        int source = findStubEntry(library, nid, &entry);
 
-        result = nid_storage_getEntry(nid, &entry);
-        if(result >= 0) {
-                sceKernelOpenVMDomain();
+        if(source >= 0) {
+                vm_patch_begin();
                 resolveStubWithEntry((void*)((SceUInt)stub & ~1), &entry);
-                sceKernelCloseVMDomain();
+                vm_patch_end();
+        }
+        return source;
+}
+
+/*
+ * Lazy stubs keep the NID in their fourth word and enter the trampoline with r12 pointing at them.
+ * Binding never touches the two instructions, a thread may be anywhere in them at any time: only
+ * the literal loaded by ldr pc changes, with a single aligned store, from the trampoline to the
+ * target. ldr pc interworks, so Thumb targets need nothing more.
+ */
+#define LAZY_STUB_SUB_R12_PC 0xE24FC008        //sub r12, pc, #8
+#define LAZY_STUB_LDR_PC 0xE51FF004            //ldr pc, [pc, #-4]
+
+//Has to be called inside a patch session
+void nid_table_deferStub(void *stub, SceNID nid)
+{
+        SceUInt *words = stub;
+
+        words[0] = LAZY_STUB_SUB_R12_PC;
+        words[1] = LAZY_STUB_LDR_PC;
+        words[2] = (SceUInt)getVhlLazyBindTrampoline();
+        words[3] = nid;
+}
+
+//Target of a stub of a loaded homebrew, without counting it as a stub analyzed at boot.
+//Stubs still waiting for the lazy binder, or that failed to bind, are reported unresolved.
+int nid_table_decodeStub(const void *stub, nidTable_entry *entry)
+{
+        const SceUInt *words = stub;
+        int res;
+
+        entry->nid = 0;
+        entry->value.i = 0;
 
-                return 0;
+        if(words[0] == LAZY_STUB_SUB_R12_PC && words[1] == LAZY_STUB_LDR_PC) {
+                if(words[2] == (SceUInt)getVhlLazyBindTrampoline() || words[2] == (SceUInt)getVhlLazyBindFailed())
+                        return ANALYZE_STUB_UNRESOLVED;
+
+                if(words[2] == (SceUInt)getVhlLazySyscall()) {
+                        entry->type = ENTRY_TYPES_SYSCALL;
+                        entry->value.i = words[3];
+                }else{
+                        entry->type = ENTRY_TYPES_FUNCTION;
+                        entry->value.i = words[2];
+                }
+                return ANALYZE_STUB_OK;
         }
-        DEBUG_LOG("Failed to find NID 0x%08x", nid);
-        return -1;
+
+        res = matchStubTemplate(words, entry);
+        if(res >= 0) return res;
+
+        return disassembleStub(stub, entry);
+}
+
+static SceNID findStubLibrary(const allocData *data, const void *stub)
+{
+        FOREACH_IMPORT(data->mod_base, data->mod_info, imports)
+        {
+                void **entryTable = GET_FUNCTIONS_ENTRYTABLE(imports);
+
+                for(unsigned int i = 0; i < GET_FUNCTION_COUNT(imports); i++)
+                        if(entryTable[i] == stub) return GET_NID(imports);
+        }
+        return NID_STORAGE_LIBRARY_VHL;
+}
+
+//Called by the trampoline on the first call of a deferred stub, returns the stub to continue the call with.
+//Any homebrew thread may get here, the patch session keeps the others and the loader out until the stub is bound.
+void *nid_table_bindLazyStub(void *stub)
+{
+        globals_t *globals = getGlobals();
+        allocData *data = NULL;
+        SceUInt *words = stub;
+        SceNID library = NID_STORAGE_LIBRARY_VHL;
+        nidTable_entry entry;
+        SceUInt target;
+
+        vm_patch_begin();
+
+        //Another thread may have bound it while this one was waiting
+        if(words[2] != (SceUInt)getVhlLazyBindTrampoline()) {
+                vm_patch_end();
+                return stub;
+        }
+
+        for(int curSlot = 0; curSlot < MAX_SLOTS; curSlot++) {
+                allocData *slot = &globals->allocatedBlocks[curSlot];
+
+                if(slot->mod_info != NULL && (SceUInt)stub - (SceUInt)slot->exec_mem_loc < (SceUInt)slot->exec_mem_size) {
+                        data = slot;
+                        break;
+                }
+        }
+        if(data != NULL) library = findStubLibrary(data, stub);
+
+        //The library is unknown without its module, the NID is then searched in every library
+        if(findStubEntry(library, words[3], &entry) < 0) {
+                target = (SceUInt)getVhlLazyBindFailed();
+        }else if(entry.type == ENTRY_TYPES_FUNCTION) {
+                target = entry.value.i;
+        }else if(entry.type == ENTRY_TYPES_SYSCALL) {
+                //Only the lock holder reads the NID, the number can take its place before the stub leads to it
+                words[3] = entry.value.i;
+                __sync_synchronize();
+                target = (SceUInt)getVhlLazySyscall();
+        }else{
+                DEBUG_LOG("NID 0x%08x is not a function", words[3]);
+                target = (SceUInt)getVhlLazyBindFailed();
+        }
+        words[2] = target;
+        if(data != NULL) sceKernelSyncVMDomain(data->exec_mem_uid, stub, 16);
+
+        globals->intOptions[VARIABLE_LAZY_BOUND_IMPORTS - 1]++;
+        vm_patch_end();
+        return stub;
 }
@@ -30,12 +30,12 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #include "config.h"
 #include "module_headers.h"
 #include "nidcache.h"
+#include "nid_db.h"
 
 
-#define NID_TABLE_MAX_MODULES 256
-
 #define SCE_MODULE_INFO_EXPECTED_ATTR     0x0000
 #define SCE_MODULE_INFO_EXPECTED_VER      0x0101
+#define NID_TABLE_MODULE_INFO_HEADER      (SCE_MODULE_INFO_EXPECTED_ATTR | SCE_MODULE_INFO_EXPECTED_VER << 16)
 
 enum {
         ANALYZE_STUB_OK,
@@ -43,9 +43,19 @@ enum {
         ANALYZE_STUB_INVAL
 };
 
+//Where nid_table_resolveStub found an import
+enum {
+        RESOLVE_STUB_HOOK,
+        RESOLVE_STUB_LOOKASIDE,
+        RESOLVE_STUB_TABLE,
+        RESOLVE_STUB_OTHER_LIBRARY      //Exported by another library than the one it is imported from
+};
+
 int nid_table_initialize();
 int nid_table_analyzeStub(const void *stub, SceNID nid, nidTable_entry *entry);
+int nid_table_decodeStub(const void *stub, nidTable_entry *entry);
 SceModuleInfo* nid_table_findModuleInfo(void* location, SceUInt size, char* libname);
+SceModuleInfo* nid_table_findModuleInfoFromAnchor(void* anchor, SceUInt maxSize, char* libname);
 int nid_table_isValidModuleInfo(SceModuleInfo *m_info);
 int nid_table_addStubsInModule(Psp2LoadedModuleInfo *target);
 void nid_table_resolveVhlPuts(void *p, const UVL_Context *ctx);
@@ -57,7 +67,10 @@ void nid_table_resolveVhlSecondaryImports(void *p, size_t size, const SceModuleI
         const UVL_Context *ctx);
 int nid_table_addNIDCacheToTable(const SceModuleImports * const cachedImports[CACHED_IMPORTED_MODULE_NUM]);
 int nid_table_addAllStubs(void);
-void nid_table_addAllHooks(void);
-int nid_table_resolveStub(void *stub, SceNID nid);
+int nid_table_refresh(void);
+int nid_table_findHook(SceNID nid, nidTable_entry *entry);
+int nid_table_resolveStub(void *stub, SceNID library, SceNID nid);
+void nid_table_deferStub(void *stub, SceNID nid);
+void *nid_table_bindLazyStub(void *stub);
 
 #endif
@@ -21,6 +21,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #if defined(PSV_3XX)
 #include "nidcache3xx.c"
 #endif
+#include "nidcache_sorted.h"
 #include "nidcache.h"
 #include "common.h"
 
@@ -31,6 +32,9 @@ void nidCacheFindCachedImports(const SceModuleInfo *libkernel,
         SceNID nid;
         unsigned int i;
 
+        for (i = 0; i < CACHED_IMPORTED_MODULE_NUM; i++)
+                imports[i] = NULL;
+
         FOREACH_IMPORT(base, libkernel, importTable) {
                 nid = GET_NID(importTable);
 
@@ -48,3 +52,17 @@ NID_CACHE* nidCache_getHeader(){
 SceNID* nidCache_getCache(){
         return (SceNID*)libkernel_nid_cache;
 }
+
+//Binary search without branches on the comparisons, the table has no more than a few hundred entries
+const NID_CACHE_ENTRY* nidCache_find(SceNID nid)
+{
+        const NID_CACHE_ENTRY *base = libkernel_nid_cache_sorted;
+        unsigned int n = sizeof(libkernel_nid_cache_sorted) / sizeof(NID_CACHE_ENTRY);
+
+        while (n > 1) {
+                unsigned int half = n / 2;
+                base = (base[half].nid <= nid) ? base + half : base;
+                n -= half;
+        }
+        return base->nid == nid ? base : NULL;
+}
@@ -37,10 +37,17 @@ typedef struct {
         SceUInt count;
 } NID_CACHE;
 
+typedef struct {
+        SceNID nid;
+        SceUInt16 module;       //CACHED_IMPORTED_MODULE_*
+        SceUInt16 index;        //Function of the import table of the module
+} NID_CACHE_ENTRY;
+
 void nidCacheFindCachedImports(const SceModuleInfo *libkernel,
                                const SceModuleImports *imports[CACHED_IMPORTED_MODULE_NUM]);
 
 NID_CACHE* nidCache_getHeader();
 SceNID* nidCache_getCache();
+const NID_CACHE_ENTRY* nidCache_find(SceNID nid);
 
 #endif
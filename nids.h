@@ -36,6 +36,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #define NID_sceKernelGetThreadInfo 0x8d9c5461
 #define NID_sceKernelWaitThreadEnd 0xddb395a9
 #define NID_sceKernelGetThreadExitStatus 0xd5dc26c4
+#define NID_sceKernelGetProcessTimeLow 0x47f6de49
 
 // SceAppMgrUser
 #define NID_sceAppMgrLoadExec 0xe6774abc
@@ -81,5 +82,9 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 // VHL
 #define NID_vhlGetIntValue 3
 #define NID_vhlSetIntValue 4
+#define NID_vhlGetNidStorageStats 5
+#define NID_vhlDumpNidStorageStats 6
+#define NID_vhlGetLoadReport 7
+#define NID_vhlDumpLoadReport 8
 
 #endif
@@ -23,6 +23,9 @@
 #include <stddef.h>
 
 void *getVhlStubTop();
+void *getVhlLazyBindTrampoline();
+void *getVhlLazySyscall();
+void *getVhlLazyBindFailed();
 
 extern int vhlPrimaryStubSizeSym[];
 extern int vhlSecondaryStubSizeSym[];
@@ -0,0 +1,88 @@
+/*
+hook_hash.c : Generates a perfect hash of the NIDs of the hooks listed in hook_list.h, runs on the build host
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "nids.h"
+
+#define HOOK_HASH_MAX_BITS 8            //Slots are stored in a byte
+#define HOOK_HASH_ATTEMPTS 1000000
+
+static const uint32_t nids[] = {
+#define VHL_HOOK(nid_name, function) NID_ ## nid_name,
+#include "hook_list.h"
+#undef VHL_HOOK
+};
+
+#define HOOK_COUNT (sizeof(nids) / sizeof(nids[0]))
+
+static int isPerfect(uint32_t multiplier, unsigned int bits)
+{
+        unsigned char used[1 << HOOK_HASH_MAX_BITS];
+
+        memset(used, 0, sizeof(used));
+        for(unsigned int i = 0; i < HOOK_COUNT; i++)
+        {
+                uint32_t slot = (uint32_t)(nids[i] * multiplier) >> (32 - bits);
+                if(used[slot]) return 0;
+                used[slot] = 1;
+        }
+        return 1;
+}
+
+int main(void)
+{
+        uint32_t multiplier = 0x9E3779B1;
+        unsigned int bits = 1;
+
+        while((1u << bits) < HOOK_COUNT) bits++;
+
+        //Try the smallest tables first, each with a sequence of odd multipliers
+        for(; bits <= HOOK_HASH_MAX_BITS; bits++)
+        {
+                for(unsigned int attempt = 0; attempt < HOOK_HASH_ATTEMPTS; attempt++)
+                {
+                        if(!isPerfect(multiplier, bits)) {
+                                multiplier = multiplier * 1664525u + 1013904223u;
+                                multiplier |= 1;
+                                continue;
+                        }
+
+                        printf("//Generated by tools/hook_hash.c from hook_list.h, do not edit\n");
+                        printf("#define HOOK_HASH_COUNT %u\n", (unsigned int)HOOK_COUNT);
+                        printf("#define HOOK_HASH_BITS %u\n", bits);
+                        printf("#define HOOK_HASH_MULTIPLIER 0x%08XU\n", multiplier);
+                        printf("//Index + 1 of the hook in forcedHooks, 0 for empty slots\n");
+                        printf("static const unsigned char hookHashSlots[1 << HOOK_HASH_BITS] = {");
+                        for(uint32_t slot = 0; slot < (1u << bits); slot++)
+                        {
+                                unsigned int index = 0;
+
+                                for(unsigned int i = 0; i < HOOK_COUNT; i++)
+                                        if((uint32_t)(nids[i] * multiplier) >> (32 - bits) == slot) index = i + 1;
+                                printf("%s%u", slot ? ", " : "", index);
+                        }
+                        printf("};\n");
+                        return 0;
+                }
+        }
+
+        fprintf(stderr, "No perfect hash found for %u hooks\n", (unsigned int)HOOK_COUNT);
+        return 1;
+}
@@ -0,0 +1,356 @@
+/*
+module_scan_test.c : Checks that the threaded module scan merges like the serial one, runs on the build host
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "module_scan.h"
+#include "nid_table.h"
+
+#define MODULE_SCAN_TEST_MODULES 60
+#define MODULE_SCAN_TEST_TABLES 4
+#define MODULE_SCAN_TEST_FUNCTIONS 24
+#define MODULE_SCAN_TEST_ROUNDS 200
+#define MODULE_SCAN_TEST_BLOCKS 16
+#define MODULE_SCAN_TEST_THREADS 8
+
+//Everything a module scan reads, kept below 4 GB since the module headers compute 32 bit addresses
+typedef struct {
+        SceModuleInfo info;
+        SceModuleExports exports[MODULE_SCAN_TEST_TABLES];
+        SceUInt nids[MODULE_SCAN_TEST_TABLES][MODULE_SCAN_TEST_FUNCTIONS];
+        void *entries[MODULE_SCAN_TEST_TABLES][MODULE_SCAN_TEST_FUNCTIONS];
+} module_scan_test_image;
+
+typedef struct {
+        SceKernelThreadEntry entry;
+        pthread_t thread;
+        SceSize args;
+        void *argp;
+        int used;
+} module_scan_test_thread;
+
+static module_scan_test_image *images;
+static unsigned int failThreads, failExports, failures;
+static unsigned int seed;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static void *blocks[MODULE_SCAN_TEST_BLOCKS];
+static module_scan_test_thread threads[MODULE_SCAN_TEST_THREADS];
+
+globals_t *getGlobals()
+{
+        return NULL;
+}
+
+int internal_printf(const char *fmt, ...)
+{
+        (void)fmt;
+        return 0;
+}
+
+SceUID sceKernelAllocMemBlock(const char *name, int type, int size, void *optp)
+{
+        SceUID uid = -1;
+
+        (void)type; (void)optp;
+
+        //Fails the export blocks of the workers picked for this round
+        pthread_mutex_lock(&mutex);
+        if(name[sizeof("vhlModuleScan") - 1] == 'E' && failExports != 0) {
+                failExports--;
+                pthread_mutex_unlock(&mutex);
+                return -1;
+        }
+        for(int i = 0; i < MODULE_SCAN_TEST_BLOCKS; i++) {
+                if(blocks[i] != NULL) continue;
+
+                blocks[i] = calloc(1, size);
+                if(blocks[i] != NULL) uid = i + 1;
+                break;
+        }
+        pthread_mutex_unlock(&mutex);
+        return uid;
+}
+
+int sceKernelGetMemBlockBase(SceUID uid, void **basep)
+{
+        int res = -1;
+
+        pthread_mutex_lock(&mutex);
+        if(uid > 0 && uid <= MODULE_SCAN_TEST_BLOCKS && blocks[uid - 1] != NULL) {
+                *basep = blocks[uid - 1];
+                res = 0;
+        }
+        pthread_mutex_unlock(&mutex);
+        return res;
+}
+
+int sceKernelFreeMemBlock(SceUID uid)
+{
+        int res = -1;
+
+        pthread_mutex_lock(&mutex);
+        if(uid > 0 && uid <= MODULE_SCAN_TEST_BLOCKS && blocks[uid - 1] != NULL) {
+                free(blocks[uid - 1]);
+                blocks[uid - 1] = NULL;
+                res = 0;
+        }
+        pthread_mutex_unlock(&mutex);
+        return res;
+}
+
+static void *threadEntry(void *arg)
+{
+        module_scan_test_thread *thread = arg;
+
+        thread->entry(thread->args, thread->argp);
+        return NULL;
+}
+
+SceUID sceKernelCreateThread(const char *name, SceKernelThreadEntry entry, int initPriority,
+                             int stackSize, SceUInt attr, int cpuAffinityMask, const void *option)
+{
+        (void)name; (void)initPriority; (void)stackSize; (void)attr; (void)cpuAffinityMask; (void)option;
+
+        if(failThreads != 0) {
+                failThreads--;
+                return -1;
+        }
+        for(int i = 0; i < MODULE_SCAN_TEST_THREADS; i++) {
+                if(threads[i].used) continue;
+
+                threads[i].used = 1;
+                threads[i].entry = entry;
+                return i + 1;
+        }
+        return -1;
+}
+
+//The argument block is copied like the kernel copies it onto the stack of the thread
+int sceKernelStartThread(SceUID thid, SceSize arglen, void *argp)
+{
+        module_scan_test_thread *thread = &threads[thid - 1];
+
+        thread->args = arglen;
+        thread->argp = malloc(arglen);
+        if(thread->argp == NULL) return -1;
+        memcpy(thread->argp, argp, arglen);
+
+        return pthread_create(&thread->thread, NULL, threadEntry, thread) == 0 ? 0 : -1;
+}
+
+int sceKernelWaitThreadEnd(SceUID thid, int *stat, SceUInt *timeout)
+{
+        (void)stat; (void)timeout;
+        return pthread_join(threads[thid - 1].thread, NULL) == 0 ? 0 : -1;
+}
+
+int sceKernelDeleteThread(SceUID thid)
+{
+        free(threads[thid - 1].argp);
+        threads[thid - 1].argp = NULL;
+        threads[thid - 1].used = 0;
+        return 0;
+}
+
+//Some modules can not be queried, the others take a random time so the workers interleave differently
+int sceKernelGetModuleInfo(SceUID modid, Psp2LoadedModuleInfo *info)
+{
+        unsigned int state = seed ^ (modid * 2654435761u);
+
+        if(modid % 11 == 5) return -1;
+        usleep(rand_r(&state) % 64);
+
+        info->segments[0].vaddr = &images[modid];
+        info->segments[0].memsz = sizeof(images[modid]);
+        info->module_name[0] = 'A' + modid % 26;
+        return 0;
+}
+
+//The information of some modules is not found
+SceModuleInfo* nid_table_findModuleInfo(void* location, SceUInt size, char* libname)
+{
+        module_scan_test_image *image = location;
+
+        (void)size; (void)libname;
+        return (image - images) % 13 == 7 ? NULL : &image->info;
+}
+
+static void *allocLow(size_t len)
+{
+        void *p;
+
+#ifdef MAP_32BIT
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+#else
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+        if(p == MAP_FAILED) return NULL;
+        if((uintptr_t)p + len > UINT32_MAX) {
+                fprintf(stderr, "No memory below 4 GB, build the test with -m32\n");
+                munmap(p, len);
+                return NULL;
+        }
+        return p;
+}
+
+//Libraries share NIDs across modules, so the merge order decides which value a NID ends up with
+static void makeImages(void)
+{
+        for(unsigned int m = 0; m < MODULE_SCAN_TEST_MODULES; m++)
+        {
+                module_scan_test_image *image = &images[m];
+                unsigned int tables = m % (MODULE_SCAN_TEST_TABLES + 1);
+
+                image->info.ent_top = 0x10;
+                image->info.ent_end = 0x10 + tables * sizeof(SceModuleExports);
+                for(unsigned int t = 0; t < tables; t++)
+                {
+                        image->exports[t].module_nid = 0x1000 + (m + t) % 7;
+                        image->exports[t].num_functions = (m * 7 + t * 5) % (MODULE_SCAN_TEST_FUNCTIONS + 1);
+                        image->exports[t].nid_table = image->nids[t];
+                        image->exports[t].entry_table = image->entries[t];
+                        for(unsigned int i = 0; i < MODULE_SCAN_TEST_FUNCTIONS; i++) {
+                                image->nids[t][i] = 0x100 * ((m + t) % 7) + i * 3 + 1;
+                                image->entries[t][i] = &image->entries[t][i];
+                        }
+                }
+        }
+}
+
+//The entries in the order the serial walk of nid_table.c adds them
+static SceUInt walkExports(const SceModuleInfo *mod_info, nidTable_entry *entries)
+{
+        SceUInt base = (SceUInt)mod_info - mod_info->ent_top + sizeof(SceModuleInfo);
+        SceUInt count = 0;
+
+        FOREACH_EXPORT(base, mod_info, exportTable)
+        {
+                for(int i = 0; i < exportTable->num_functions; i++, count++)
+                {
+                        entries[count].nid = exportTable->nid_table[i];
+                        entries[count].library = exportTable->module_nid;
+                        entries[count].type = ENTRY_TYPES_FUNCTION;
+                        entries[count].value.p = exportTable->entry_table[i];
+                }
+        }
+        return count;
+}
+
+static SceUInt serialScan(const SceUID *uids, nidTable_entry *entries)
+{
+        Psp2LoadedModuleInfo info;
+        SceModuleInfo *mod_info;
+        SceUInt count = 0;
+
+        for(unsigned int i = 0; i < MODULE_SCAN_TEST_MODULES; i++)
+        {
+                if(sceKernelGetModuleInfo(uids[i], &info) < 0) continue;
+
+                mod_info = nid_table_findModuleInfo(info.segments[0].vaddr, info.segments[0].memsz, info.module_name);
+                if(mod_info != NULL) count += walkExports(mod_info, entries + count);
+        }
+        return count;
+}
+
+//Merges like addStubsInModules, walking the modules whose worker had no memory for the exports
+static SceUInt threadedScan(const SceUID *uids, nidTable_entry *entries)
+{
+        module_scan scan;
+        SceUInt count = 0;
+
+        if(module_scan_run(&scan, uids, MODULE_SCAN_TEST_MODULES) < 0) {
+                printf("FAIL: module_scan_run failed\n");
+                failures++;
+                return 0;
+        }
+
+        for(unsigned int i = 0; i < scan.count; i++)
+        {
+                const module_scan_entry *module = &scan.modules[i];
+
+                if(module->info.size == 0 || module->mod_info == NULL) continue;
+
+                if(module->exports == NULL) {
+                        count += walkExports(module->mod_info, entries + count);
+                        continue;
+                }
+                memcpy(entries + count, module->exports, module->export_count * sizeof(nidTable_entry));
+                count += module->export_count;
+        }
+
+        module_scan_free(&scan);
+        return count;
+}
+
+static int sameEntries(const nidTable_entry *a, const nidTable_entry *b, SceUInt count)
+{
+        for(SceUInt i = 0; i < count; i++)
+        {
+                if(a[i].nid != b[i].nid || a[i].library != b[i].library ||
+                   a[i].type != b[i].type || a[i].value.p != b[i].value.p)
+                        return 0;
+        }
+        return 1;
+}
+
+int main(void)
+{
+        static nidTable_entry expected[MODULE_SCAN_TEST_MODULES * MODULE_SCAN_TEST_TABLES * MODULE_SCAN_TEST_FUNCTIONS];
+        static nidTable_entry merged[MODULE_SCAN_TEST_MODULES * MODULE_SCAN_TEST_TABLES * MODULE_SCAN_TEST_FUNCTIONS];
+        SceUID uids[MODULE_SCAN_TEST_MODULES];
+        SceUInt expectedCount, mergedCount;
+
+        images = allocLow(MODULE_SCAN_TEST_MODULES * sizeof(module_scan_test_image));
+        if(images == NULL) return 1;
+        makeImages();
+
+        for(unsigned int round = 0; round < MODULE_SCAN_TEST_ROUNDS; round++)
+        {
+                //Module lists in another order than loaded, some rounds lose workers or their export memory
+                seed = round;
+                for(unsigned int i = 0; i < MODULE_SCAN_TEST_MODULES; i++)
+                        uids[i] = (i * 37 + round) % MODULE_SCAN_TEST_MODULES;
+                failThreads = round % 5 == 1 ? round % (NID_TABLE_SCAN_WORKERS + 1) : 0;
+                failExports = round % 7 == 3 ? 1 : 0;
+
+                expectedCount = serialScan(uids, expected);
+                mergedCount = threadedScan(uids, merged);
+
+                if(mergedCount != expectedCount || !sameEntries(merged, expected, expectedCount)) {
+                        printf("FAIL: round %u merged %u entries unlike the %u of the serial scan\n",
+                               round, mergedCount, expectedCount);
+                        failures++;
+                }
+                for(int i = 0; i < MODULE_SCAN_TEST_BLOCKS; i++)
+                        if(blocks[i] != NULL) {
+                                printf("FAIL: round %u leaked block %d\n", round, i + 1);
+                                failures++;
+                                free(blocks[i]);
+                                blocks[i] = NULL;
+                        }
+        }
+
+        munmap(images, MODULE_SCAN_TEST_MODULES * sizeof(module_scan_test_image));
+        if(failures == 0) printf("module_scan: %d rounds merged like the serial scan\n", MODULE_SCAN_TEST_ROUNDS);
+        return failures != 0;
+}
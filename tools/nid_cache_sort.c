@@ -0,0 +1,79 @@
+/*
+nid_cache_sort.c : Generates the NID sorted copy of the libkernel NID cache, runs on the build host
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#include <stdio.h>
+#if defined(PSV_3XX)
+#include "nidcache3xx.c"
+#endif
+
+#define NID_CACHE_SIZE (sizeof(libkernel_nid_cache) / sizeof(libkernel_nid_cache[0]))
+
+static const char * const moduleNames[CACHED_IMPORTED_MODULE_NUM] = {
+        [CACHED_IMPORTED_MODULE_SceSysmem] = "CACHED_IMPORTED_MODULE_SceSysmem",
+        [CACHED_IMPORTED_MODULE_SceThreadmgr] = "CACHED_IMPORTED_MODULE_SceThreadmgr",
+        [CACHED_IMPORTED_MODULE_SceModulemgr] = "CACHED_IMPORTED_MODULE_SceModulemgr",
+        [CACHED_IMPORTED_MODULE_SceProcessmgr] = "CACHED_IMPORTED_MODULE_SceProcessmgr",
+        [CACHED_IMPORTED_MODULE_SceIofilemgr] = "CACHED_IMPORTED_MODULE_SceIofilemgr"
+};
+
+int main(void)
+{
+        NID_CACHE_ENTRY entries[NID_CACHE_SIZE], entry;
+        unsigned int count = 0, offset = 0, i, j;
+
+        for(unsigned int module = 0; module < CACHED_IMPORTED_MODULE_NUM; module++)
+        {
+                for(i = 0; i < libkernel_nid_cache_header[module].count; i++, offset++)
+                {
+                        if(offset >= NID_CACHE_SIZE) {
+                                fprintf(stderr, "The header counts more NIDs than libkernel_nid_cache holds\n");
+                                return 1;
+                        }
+
+                        //Zero is a placeholder for a function the firmware does not import
+                        if(libkernel_nid_cache[offset] == 0) continue;
+
+                        entry.nid = libkernel_nid_cache[offset];
+                        entry.module = module;
+                        entry.index = i;
+
+                        //Insertion sort, the cache holds a few hundred NIDs
+                        for(j = count; j > 0 && entries[j - 1].nid > entry.nid; j--)
+                                entries[j] = entries[j - 1];
+                        if(j > 0 && entries[j - 1].nid == entry.nid) {
+                                fprintf(stderr, "NID 0x%08X is cached twice\n", entry.nid);
+                                return 1;
+                        }
+                        entries[j] = entry;
+                        count++;
+                }
+        }
+        if(offset != NID_CACHE_SIZE) {
+                fprintf(stderr, "The header counts %u NIDs, libkernel_nid_cache holds %u\n",
+                        offset, (unsigned int)NID_CACHE_SIZE);
+                return 1;
+        }
+
+        printf("//Generated by tools/nid_cache_sort.c from the libkernel NID cache, do not edit\n");
+        printf("//NIDs of libkernel_nid_cache sorted for a binary search, placeholders left out\n");
+        printf("static const NID_CACHE_ENTRY libkernel_nid_cache_sorted[] = {\n");
+        for(i = 0; i < count; i++)
+                printf("    {0x%X, %s, %u},\n", entries[i].nid, moduleNames[entries[i].module], entries[i].index);
+        printf("};\n");
+        return 0;
+}
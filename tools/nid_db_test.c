@@ -0,0 +1,386 @@
+/*
+nid_db_test.c : Round-trips the NID database through a file, runs on the build host
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "utils/utils.h"
+#include "vhl.h"
+
+#define NID_DB_TEST_MODULES 3
+#define NID_DB_TEST_IMPORTS 2
+#define NID_DB_TEST_IMAGE 0x1000
+#define NID_DB_TEST_STUB_TOP 0x200
+#define NID_DB_TEST_BLOCKS 4
+
+typedef struct {
+        Psp2LoadedModuleInfo target;
+        SceModuleInfo *mod_info;
+        SceNID nids[NID_DB_TEST_IMPORTS * 8];
+        SceUInt nid_count;
+} nid_db_test_module;
+
+static globals_t globals;
+static const char *dbPath;
+static int verbose, writes, failures;
+static void *blocks[NID_DB_TEST_BLOCKS];
+
+globals_t *getGlobals()
+{
+        return &globals;
+}
+
+int internal_printf(const char *fmt, ...)
+{
+        va_list va;
+
+        if(!verbose) return 0;
+        va_start(va, fmt);
+        vfprintf(stderr, fmt, va);
+        va_end(va);
+        fputc('\n', stderr);
+        return 0;
+}
+
+//utils.c replaces the C library on the Vita, only its hash is needed here
+SceUInt hash_fnv1a(SceUInt hash, const void *data, SceUInt len)
+{
+        const unsigned char *ptr = data;
+
+        for(SceUInt i = 0; i < len; i++)
+        {
+                hash ^= ptr[i];
+                hash *= 0x01000193;
+        }
+        return hash;
+}
+
+SceUID sceKernelAllocMemBlock(const char *name, int type, int size, void *optp)
+{
+        (void)name; (void)type; (void)optp;
+
+        for(int i = 0; i < NID_DB_TEST_BLOCKS; i++) {
+                if(blocks[i] != NULL) continue;
+
+                blocks[i] = calloc(1, size);
+                return blocks[i] == NULL ? -1 : i + 1;
+        }
+        return -1;
+}
+
+int sceKernelGetMemBlockBase(SceUID uid, void **basep)
+{
+        if(uid <= 0 || uid > NID_DB_TEST_BLOCKS || blocks[uid - 1] == NULL) return -1;
+        *basep = blocks[uid - 1];
+        return 0;
+}
+
+int sceKernelFreeMemBlock(SceUID uid)
+{
+        if(uid <= 0 || uid > NID_DB_TEST_BLOCKS || blocks[uid - 1] == NULL) return -1;
+        free(blocks[uid - 1]);
+        blocks[uid - 1] = NULL;
+        return 0;
+}
+
+//Every file of VHL is the database file here
+SceUID sceIoOpen(const char *file, int flags, SceMode mode)
+{
+        int hostFlags = (flags & PSP2_O_WRONLY) ? O_WRONLY : O_RDONLY;
+
+        (void)file;
+        if(flags & PSP2_O_CREAT) hostFlags |= O_CREAT;
+        if(flags & PSP2_O_TRUNC) hostFlags |= O_TRUNC;
+
+        return open(dbPath, hostFlags, mode);
+}
+
+int sceIoClose(SceUID fd)
+{
+        return close(fd);
+}
+
+int sceIoRead(SceUID fd, void *data, SceSize size)
+{
+        return read(fd, data, size);
+}
+
+int sceIoWrite(SceUID fd, const void *data, SceSize size)
+{
+        writes++;
+        return write(fd, data, size);
+}
+
+int sceIoMkdir(const char *dir, SceMode mode)
+{
+        (void)dir; (void)mode;
+        return 0;
+}
+
+//The module headers compute 32 bit addresses, so the images have to live below 4 GB
+static void *allocLow(size_t len)
+{
+        void *p;
+
+#ifdef MAP_32BIT
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+#else
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+        if(p == MAP_FAILED) return NULL;
+        if((uintptr_t)p + len > UINT32_MAX) {
+                fprintf(stderr, "No memory below 4 GB, build the test with -m32\n");
+                munmap(p, len);
+                return NULL;
+        }
+        return p;
+}
+
+//An image holding the module information, one export table and the import tables right after stub_top
+static int makeModule(nid_db_test_module *module, const char *name, unsigned int seed)
+{
+        unsigned char *image = allocLow(NID_DB_TEST_IMAGE);
+        SceModuleExports *exports;
+        SceModuleImports *imports;
+        SceUInt *exportNids;
+
+        if(image == NULL) return -1;
+
+        memset(module, 0, sizeof(*module));
+        for(unsigned int i = 0; i < sizeof(module->target.module_name) - 1 && name[i] != 0; i++)
+                module->target.module_name[i] = name[i];
+        module->target.segments[0].vaddr = image;
+        module->target.segments[0].memsz = NID_DB_TEST_IMAGE;
+        module->target.segments[1].memsz = 0x100 * seed;
+
+        module->mod_info = (SceModuleInfo*)image;
+        module->mod_info->ent_top = 0x40;
+        module->mod_info->ent_end = 0x40 + sizeof(SceModuleExports);
+        module->mod_info->stub_top = NID_DB_TEST_STUB_TOP;
+        module->mod_info->stub_end = NID_DB_TEST_STUB_TOP + NID_DB_TEST_IMPORTS * sizeof(SceModuleImports_3x);
+
+        exports = (SceModuleExports*)(module->mod_info + 1);
+        exportNids = (SceUInt*)(image + NID_DB_TEST_STUB_TOP - 2 * sizeof(SceUInt));
+        exportNids[0] = 0x1000 * seed;
+        exportNids[1] = 0x1000 * seed + 1;
+        exports->module_nid = seed;
+        exports->num_functions = 2;
+        exports->nid_table = exportNids;
+
+        imports = (SceModuleImports*)(image + NID_DB_TEST_STUB_TOP);
+        for(unsigned int i = 0; i < NID_DB_TEST_IMPORTS; i++) {
+                imports->new_version.size = sizeof(SceModuleImports_3x);
+                imports->new_version.num_functions = 1 + (seed + i) % 4;
+                imports->new_version.num_vars = i;
+                module->nid_count += 1 + imports->new_version.num_functions + imports->new_version.num_vars;
+                imports = GET_NEXT_IMPORT(imports);
+        }
+
+        for(unsigned int i = 0; i < module->nid_count; i++)
+                module->nids[i] = seed * 0x01000193 + i;
+
+        return 0;
+}
+
+static void freeModule(nid_db_test_module *module)
+{
+        munmap(module->target.segments[0].vaddr, NID_DB_TEST_IMAGE);
+}
+
+//Same order as the boot: the stored NIDs when they still match, the resolved stubs otherwise.
+//Returns 1 when the module was restored from the database.
+static int loadModule(const nid_db_test_module *module)
+{
+        const SceNID *nids = nid_db_restoreModule(&module->target, module->mod_info);
+
+        if(nids != NULL)
+                return memcmp(nids, module->nids, module->nid_count * sizeof(SceNID)) == 0 ? 1 : -1;
+
+        nid_db_beginModule(&module->target, module->mod_info);
+        nid_db_addNids(module->nids, 1);
+        nid_db_addNids(module->nids + 1, module->nid_count - 1);
+        return 0;
+}
+
+static void check(int ok, const char *what)
+{
+        if(ok) return;
+        printf("FAIL: %s\n", what);
+        failures++;
+}
+
+//Opens the database, loads the modules and closes it, expected holds what loadModule returns for each
+static void boot(const char *what, nid_db_test_module *modules, unsigned int count, const int *expected, int expectWrite)
+{
+        writes = 0;
+        check(nid_db_open() == 0, what);
+        for(unsigned int i = 0; i < count; i++) {
+                int res = loadModule(&modules[i]);
+
+                if(res != expected[i]) {
+                        printf("FAIL: %s: %s %s\n", what, modules[i].target.module_name,
+                               res < 0 ? "restored wrong NIDs" : res ? "restored" : "not restored");
+                        failures++;
+                }
+        }
+        check(nid_db_close() == 0, what);
+
+        if((writes != 0) != expectWrite) {
+                printf("FAIL: %s: database %s\n", what, expectWrite ? "not saved" : "saved again");
+                failures++;
+        }
+}
+
+//Same as boot for a module loaded after the boot, which the refresh adds to the stored records
+static void refresh(const char *what, const nid_db_test_module *module, int expected, int expectWrite)
+{
+        int res;
+
+        writes = 0;
+        check(nid_db_reopen() == 0, what);
+        res = loadModule(module);
+        if(res != expected) {
+                printf("FAIL: %s: %s %s\n", what, module->target.module_name,
+                       res < 0 ? "restored wrong NIDs" : res ? "restored" : "not restored");
+                failures++;
+        }
+        check(nid_db_close() == 0, what);
+
+        if((writes != 0) != expectWrite) {
+                printf("FAIL: %s: database %s\n", what, expectWrite ? "not saved" : "saved again");
+                failures++;
+        }
+}
+
+//Rewrites len bytes of the saved database at offset, or truncates it there when data is NULL
+static void corrupt(off_t offset, const void *data, size_t len)
+{
+        int fd = open(dbPath, O_WRONLY);
+
+        if(fd < 0) {
+                check(0, "database file missing");
+                return;
+        }
+        if(data == NULL) check(ftruncate(fd, offset) == 0, "truncate");
+        else check(pwrite(fd, data, len, offset) == (ssize_t)len, "corrupt");
+        close(fd);
+}
+
+int main(int argc, char **argv)
+{
+        static const int none[NID_DB_TEST_MODULES] = {0, 0, 0};
+        static const int all[NID_DB_TEST_MODULES] = {1, 1, 1};
+        static const int exceptLast[NID_DB_TEST_MODULES] = {1, 1, 0};
+        nid_db_test_module modules[NID_DB_TEST_MODULES + 1];
+        SceUInt value;
+        char path[] = "/tmp/vhlNidDbXXXXXX";
+        int fd;
+
+        if(argc > 1 && argv[1][0] == '-' && argv[1][1] == 'v') verbose = 1;
+
+        fd = mkstemp(path);
+        if(fd < 0) {
+                perror("mkstemp");
+                return 1;
+        }
+        close(fd);
+        unlink(path);
+        dbPath = path;
+
+        if(makeModule(&modules[0], "SceLibKernel", 1) < 0 ||
+           makeModule(&modules[1], "SceSysmem", 2) < 0 ||
+           makeModule(&modules[2], "SceLibc", 3) < 0 ||
+           makeModule(&modules[3], "SceNet", 4) < 0)
+                return 1;
+
+        boot("first boot", modules, NID_DB_TEST_MODULES, none, 1);
+        boot("second boot", modules, NID_DB_TEST_MODULES, all, 0);
+
+        //A module updated in place keeps its name but changes size, its record has to be replaced
+        modules[2].target.segments[1].memsz += 0x100;
+        boot("resized module", modules, NID_DB_TEST_MODULES, exceptLast, 1);
+        boot("after resize", modules, NID_DB_TEST_MODULES, all, 0);
+
+        //Same size but another import table shape
+        ((SceModuleImports*)((uintptr_t)modules[2].target.segments[0].vaddr + NID_DB_TEST_STUB_TOP))->new_version.num_vars++;
+        modules[2].nid_count++;
+        boot("reshaped imports", modules, NID_DB_TEST_MODULES, exceptLast, 1);
+
+        //A module replaced by another one at the same position
+        boot("renamed module", modules + 1, NID_DB_TEST_MODULES, (const int[]){1, 1, 0}, 1);
+        boot("module went away", modules + 1, NID_DB_TEST_MODULES - 1, all, 1);
+
+        //A module whose NIDs could not all be recovered is not stored
+        writes = 0;
+        check(nid_db_open() == 0, "abort: open");
+        check(loadModule(&modules[1]) == 1, "abort: first module");
+        nid_db_beginModule(&modules[0].target, modules[0].mod_info);
+        nid_db_addNids(modules[0].nids, 1);
+        nid_db_abortModule();
+        check(loadModule(&modules[2]) == 1, "abort: last module");
+        check(nid_db_close() == 0, "abort: close");
+        check(writes != 0, "abort: database not saved");
+        boot("after abort", modules, NID_DB_TEST_MODULES, (const int[]){0, 1, 1}, 1);
+
+        //Modules loaded after the boot are recorded once and then restored, also after the next boots
+        refresh("refresh", &modules[3], 0, 1);
+        refresh("second refresh", &modules[3], 1, 0);
+        boot("boot after refresh", modules, NID_DB_TEST_MODULES, all, 0);
+        refresh("refresh after boot", &modules[3], 1, 0);
+        boot("refreshed module at boot", modules + 1, NID_DB_TEST_MODULES, all, 1);
+        refresh("refreshed module after boot", &modules[3], 1, 0);
+        boot("refreshed module went away", modules, NID_DB_TEST_MODULES, (const int[]){0, 1, 1}, 1);
+        refresh("refresh after it went away", &modules[3], 0, 1);
+        boot("back to three modules", modules, NID_DB_TEST_MODULES, all, 0);
+
+        //Headers that do not describe the file make the boot scan every module and save a new database
+        value = NID_DB_MAGIC + 1;
+        corrupt(offsetof(nid_db_header, magic), &value, sizeof(value));
+        boot("bad magic", modules, NID_DB_TEST_MODULES, none, 1);
+
+        value = NID_DB_VERSION - 1;
+        corrupt(offsetof(nid_db_header, version), &value, sizeof(value));
+        boot("stale version", modules, NID_DB_TEST_MODULES, none, 1);
+
+        value = sizeof(nid_db_header);
+        corrupt(offsetof(nid_db_header, size), &value, sizeof(value));
+        boot("bad size", modules, NID_DB_TEST_MODULES, none, 1);
+
+        value = NID_DB_MAX_MODULES;
+        corrupt(offsetof(nid_db_header, module_count), &value, sizeof(value));
+        boot("bad module count", modules, NID_DB_TEST_MODULES, none, 1);
+
+        value = NID_DB_MAX_NIDS + 1;
+        corrupt(sizeof(nid_db_header) + offsetof(nid_db_module, nid_count), &value, sizeof(value));
+        boot("bad NID count", modules, NID_DB_TEST_MODULES, none, 1);
+
+        corrupt(sizeof(nid_db_header) + sizeof(nid_db_module), NULL, 0);
+        boot("truncated", modules, NID_DB_TEST_MODULES, none, 1);
+        boot("after rebuild", modules, NID_DB_TEST_MODULES, all, 0);
+
+        unlink(path);
+        for(unsigned int i = 0; i < NID_DB_TEST_MODULES + 1; i++)
+                freeModule(&modules[i]);
+
+        if(failures == 0) printf("nid_db: all checks passed\n");
+        return failures != 0;
+}
@@ -0,0 +1,43 @@
+/*
+fcntl.h : The file functions of the Vita SDK, implemented by the host tools
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef VHL_TOOLS_PSP2_IO_FCNTL_H
+#define VHL_TOOLS_PSP2_IO_FCNTL_H
+
+#include <psp2/types.h>
+
+#define PSP2_O_RDONLY 0x0001
+#define PSP2_O_WRONLY 0x0002
+#define PSP2_O_RDWR (PSP2_O_RDONLY | PSP2_O_WRONLY)
+#define PSP2_O_APPEND 0x0100
+#define PSP2_O_CREAT 0x0200
+#define PSP2_O_TRUNC 0x0400
+
+enum {
+        PSP2_SEEK_SET,
+        PSP2_SEEK_CUR,
+        PSP2_SEEK_END
+};
+
+SceUID sceIoOpen(const char *file, int flags, SceMode mode);
+int sceIoClose(SceUID fd);
+int sceIoRead(SceUID fd, void *data, SceSize size);
+int sceIoWrite(SceUID fd, const void *data, SceSize size);
+SceOff sceIoLseek(SceUID fd, SceOff offset, int whence);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+stat.h : The directory functions of the Vita SDK, implemented by the host tools
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef VHL_TOOLS_PSP2_IO_STAT_H
+#define VHL_TOOLS_PSP2_IO_STAT_H
+
+#include <psp2/types.h>
+
+int sceIoMkdir(const char *dir, SceMode mode);
+
+#endif
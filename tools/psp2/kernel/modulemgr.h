@@ -0,0 +1,57 @@
+/*
+modulemgr.h : The module manager types of the Vita SDK used by the host tools
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef VHL_TOOLS_PSP2_KERNEL_MODULEMGR_H
+#define VHL_TOOLS_PSP2_KERNEL_MODULEMGR_H
+
+#include <psp2/types.h>
+
+typedef struct {
+        SceUInt size;
+        SceUInt perms;
+        void *vaddr;
+        SceUInt memsz;
+        SceUInt flags;
+        SceUInt res;
+} Psp2SegmentInfo;
+
+typedef struct {
+        SceUInt size;
+        SceUInt handle;
+        SceUInt flags;
+        char module_name[28];
+        SceUInt unknown1;
+        void *module_start;
+        SceUInt unknown2;
+        void *module_stop;
+        void *exidxTop;
+        void *exidxBtm;
+        SceUInt unknown3;
+        SceUInt unknown4;
+        void *tlsInit;
+        SceSize tlsInitSize;
+        SceSize tlsAreaSize;
+        char path[256];
+        Psp2SegmentInfo segments[4];
+        SceUInt type;
+} Psp2LoadedModuleInfo;
+
+int sceKernelGetModuleList(int flags, SceUID *modids, unsigned int *num);
+int sceKernelGetModuleInfo(SceUID modid, Psp2LoadedModuleInfo *info);
+
+#endif
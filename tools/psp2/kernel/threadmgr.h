@@ -0,0 +1,35 @@
+/*
+threadmgr.h : The thread manager functions of the Vita SDK, implemented by the host tools
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef VHL_TOOLS_PSP2_KERNEL_THREADMGR_H
+#define VHL_TOOLS_PSP2_KERNEL_THREADMGR_H
+
+#include <psp2/types.h>
+
+typedef int (*SceKernelThreadEntry)(SceSize args, void *argp);
+
+SceUID sceKernelCreateThread(const char *name, SceKernelThreadEntry entry, int initPriority,
+                             int stackSize, SceUInt attr, int cpuAffinityMask, const void *option);
+int sceKernelStartThread(SceUID thid, SceSize arglen, void *argp);
+int sceKernelWaitThreadEnd(SceUID thid, int *stat, SceUInt *timeout);
+int sceKernelDeleteThread(SceUID thid);
+int sceKernelExitDeleteThread(int status);
+int sceKernelGetThreadId(void);
+int sceKernelDelayThread(SceUInt delay);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+types.h : The types of the Vita SDK used by the code built for the host by tools/
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef VHL_TOOLS_PSP2_TYPES_H
+#define VHL_TOOLS_PSP2_TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int8_t SceInt8;
+typedef uint8_t SceUInt8;
+typedef int16_t SceInt16;
+typedef uint16_t SceUInt16;
+typedef uint16_t SceUShort16;
+typedef int32_t SceInt;
+typedef uint32_t SceUInt;
+typedef int32_t SceInt32;
+typedef uint32_t SceUInt32;
+typedef int64_t SceInt64;
+typedef uint64_t SceUInt64;
+typedef int SceUID;
+typedef unsigned int SceSize;
+typedef int64_t SceOff;
+typedef int SceMode;
+
+#endif
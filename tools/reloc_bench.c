@@ -0,0 +1,357 @@
+/*
+reloc_bench.c : Replays the relocations of homebrew through elf_relocate_apply, runs on the build host
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "elf_relocate.h"
+
+#define RELOC_BENCH_ROUNDS 1000
+#define RELOC_BENCH_ALIGN 16
+
+//The engine logs through the printf of VHL, which would only slow the replay down here
+int internal_printf(const char *fmt, ...)
+{
+        (void)fmt;
+        return 0;
+}
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned char *readFile(const char *path, size_t *len)
+{
+        unsigned char *data;
+        FILE *f = fopen(path, "rb");
+
+        if(f == NULL) return NULL;
+        fseek(f, 0, SEEK_END);
+        *len = ftell(f);
+        fseek(f, 0, SEEK_SET);
+
+        data = malloc(*len);
+        if(data != NULL && fread(data, 1, *len, f) != *len) {
+                free(data);
+                data = NULL;
+        }
+        fclose(f);
+        return data;
+}
+
+//The relocations compute 32 bit addresses, so the segments have to live below 4 GB
+static unsigned char *allocLow(size_t len)
+{
+        void *p;
+
+#ifdef MAP_32BIT
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+#else
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+        if(p == MAP_FAILED) return NULL;
+        if((uintptr_t)p + len > UINT32_MAX) {
+                fprintf(stderr, "No memory below 4 GB, build the benchmark with -m32\n");
+                munmap(p, len);
+                return NULL;
+        }
+        return p;
+}
+
+/*
+ * The per entry engine elf_relocate_apply replaced, applying the relocations in file order. Two
+ * differences keep it from reading outside the segments on broken input: entries with segments
+ * past count are skipped, and so are branches out of range, where the old loop wrote the value
+ * left over from the previous entry.
+ */
+static int referenceRelocate(const void *reloc, SceUInt size, const Elf32_Phdr *segs, SceUInt count)
+{
+        const SceReloc *entry;
+        SceUInt pos, r_offset, r_addend, r_symseg, r_datseg, symval, loc, value;
+        SceUInt upper, lower, sign, j1, j2;
+        SceInt offset;
+        int applied = 0;
+
+        pos = 0;
+        while (pos + 8 <= size)
+        {
+                entry = (const SceReloc *)((const char *)reloc + pos);
+                if (SCE_RELOC_IS_SHORT (*entry))
+                {
+                        r_offset = SCE_RELOC_SHORT_OFFSET (entry->r_short);
+                        r_addend = SCE_RELOC_SHORT_ADDEND (entry->r_short);
+                        pos += 8;
+                }
+                else
+                {
+                        if (pos + 12 > size)
+                                break;
+                        r_offset = SCE_RELOC_LONG_OFFSET (entry->r_long);
+                        r_addend = SCE_RELOC_LONG_ADDEND (entry->r_long);
+                        pos += 12;
+                }
+
+                r_symseg = SCE_RELOC_SYMSEG (*entry);
+                r_datseg = SCE_RELOC_DATSEG (*entry);
+                if (r_datseg >= count || (r_symseg != ELF_RELOCATE_SYMSEG_NONE && r_symseg >= count))
+                        continue;
+                if (segs[r_datseg].p_filesz < 4 || r_offset > segs[r_datseg].p_filesz - 4)
+                        continue;
+
+                symval = r_symseg == ELF_RELOCATE_SYMSEG_NONE ? 0 : (SceUInt)segs[r_symseg].p_vaddr;
+                loc = (SceUInt)segs[r_datseg].p_vaddr + r_offset;
+                memcpy(&value, (const void *)(uintptr_t)loc, sizeof(value));
+                upper = value & 0xffff;
+                lower = value >> 16;
+
+                switch (SCE_RELOC_CODE (*entry))
+                {
+                case R_ARM_V4BX:
+                        value = (value & 0xf000000f) | 0x01a0f000;
+                        break;
+                case R_ARM_ABS32:
+                case R_ARM_TARGET1:
+                        value = r_addend + symval;
+                        break;
+                case R_ARM_REL32:
+                case R_ARM_TARGET2:
+                        value = r_addend + symval - loc;
+                        break;
+                case R_ARM_THM_CALL:
+                        offset = r_addend + symval - loc;
+                        if (offset <= (SceInt)0xff000000 || offset >= (SceInt)0x01000000)
+                                continue;
+
+                        sign = (offset >> 24) & 1;
+                        j1 = sign ^ (~(offset >> 23) & 1);
+                        j2 = sign ^ (~(offset >> 22) & 1);
+                        upper = (upper & 0xf800) | (sign << 10) | ((offset >> 12) & 0x03ff);
+                        lower = (lower & 0xd000) | (j1 << 13) | (j2 << 11) | ((offset >> 1) & 0x07ff);
+                        value = (lower << 16) | upper;
+                        break;
+                case R_ARM_CALL:
+                case R_ARM_JUMP24:
+                        offset = r_addend + symval - loc;
+                        if (offset <= (SceInt)0xfe000000 || offset >= (SceInt)0x02000000)
+                                continue;
+
+                        value = (value & 0xff000000) | ((offset >> 2) & 0x00ffffff);
+                        break;
+                case R_ARM_PREL31:
+                        value = (r_addend + symval - loc) & 0x7fffffff;
+                        break;
+                case R_ARM_MOVW_ABS_NC:
+                case R_ARM_MOVT_ABS:
+                        offset = symval + r_addend;
+                        if (SCE_RELOC_CODE (*entry) == R_ARM_MOVT_ABS)
+                                offset >>= 16;
+
+                        value = (value & 0xfff0f000) | ((offset & 0xf000) << 4) | (offset & 0x0fff);
+                        break;
+                case R_ARM_THM_MOVW_ABS_NC:
+                case R_ARM_THM_MOVT_ABS:
+                        offset = r_addend + symval;
+                        if (SCE_RELOC_CODE (*entry) == R_ARM_THM_MOVT_ABS)
+                                offset >>= 16;
+
+                        upper = (upper & 0xfbf0) | ((offset & 0xf000) >> 12) | ((offset & 0x0800) >> 1);
+                        lower = (lower & 0x8f00) | ((offset & 0x0700) << 4) | (offset & 0x00ff);
+                        value = (lower << 16) | upper;
+                        break;
+                default:
+                        continue;
+                }
+
+                memcpy((void *)(uintptr_t)loc, &value, sizeof(value));
+                applied++;
+        }
+
+        return applied;
+}
+
+//Each run starts from the segments as they are in the file
+static void loadImage(const unsigned char *file, const Elf32_Phdr *phdrs, unsigned int count)
+{
+        for(unsigned int i = 0; i < count; i++) {
+                if(phdrs[i].p_type != PH_LOAD) continue;
+
+                memcpy((void *)(uintptr_t)phdrs[i].p_vaddr, file + phdrs[i].p_offset, phdrs[i].p_filesz);
+                memset((void *)(uintptr_t)(phdrs[i].p_vaddr + phdrs[i].p_filesz), 0, phdrs[i].p_memsz - phdrs[i].p_filesz);
+        }
+}
+
+//Relocates the image with both engines and compares the results byte for byte
+static int compare(const char *path, const unsigned char *file, const Elf32_Phdr *phdrs, unsigned int count,
+                   unsigned char *image, size_t image_size, elf_relocate_entry *scratch)
+{
+        unsigned char *expected;
+        int reference = 0, grouped = 0;
+
+        expected = malloc(image_size);
+        if(expected == NULL) {
+                fprintf(stderr, "%s: out of memory\n", path);
+                return -1;
+        }
+
+        loadImage(file, phdrs, count);
+        for(unsigned int i = 0; i < count; i++)
+                if(phdrs[i].p_type == PH_SCE_RELOCATE)
+                        reference += referenceRelocate(file + phdrs[i].p_offset, phdrs[i].p_filesz, phdrs, count);
+        memcpy(expected, image, image_size);
+
+        loadImage(file, phdrs, count);
+        for(unsigned int i = 0; i < count; i++)
+                if(phdrs[i].p_type == PH_SCE_RELOCATE)
+                        grouped += elf_relocate_apply(file + phdrs[i].p_offset, phdrs[i].p_filesz, phdrs, count, scratch);
+
+        for(size_t i = 0; i < image_size; i++) {
+                if(image[i] == expected[i]) continue;
+
+                fprintf(stderr, "%s: images differ at 0x%zx, 0x%02x instead of 0x%02x\n", path, i, image[i], expected[i]);
+                free(expected);
+                return -1;
+        }
+        free(expected);
+
+        if(reference != grouped) {
+                fprintf(stderr, "%s: %d relocations applied instead of %d\n", path, grouped, reference);
+                return -1;
+        }
+        printf("%s: %d relocations, images identical\n", path, grouped);
+        return 0;
+}
+
+static int bench(const char *path, unsigned int rounds, int check)
+{
+        Elf32_Phdr phdrs[ELF_RELOCATE_MAX_SEGMENTS];
+        elf_relocate_entry *scratch;
+        const Elf32_Ehdr *hdr;
+        unsigned char *file, *image;
+        size_t len, image_size = 0, reloc_size = 0;
+        unsigned long long applied = 0;
+        double elapsed = 0, start;
+
+        file = readFile(path, &len);
+        if(file == NULL || len < sizeof(Elf32_Ehdr)) {
+                fprintf(stderr, "%s: can not be read\n", path);
+                return -1;
+        }
+
+        hdr = (const Elf32_Ehdr *)file;
+        if(hdr->e_ident[EI_MAG0] != ELFMAG0 || hdr->e_ident[EI_MAG1] != ELFMAG1 ||
+           hdr->e_ident[EI_MAG2] != ELFMAG2 || hdr->e_ident[EI_MAG3] != ELFMAG3 ||
+           hdr->e_type != ET_SCE_RELEXEC || hdr->e_phentsize != sizeof(Elf32_Phdr) ||
+           hdr->e_phnum > ELF_RELOCATE_MAX_SEGMENTS || hdr->e_phoff + hdr->e_phnum * sizeof(Elf32_Phdr) > len) {
+                fprintf(stderr, "%s: not a relocatable SCE executable\n", path);
+                free(file);
+                return -1;
+        }
+        memcpy(phdrs, file + hdr->e_phoff, hdr->e_phnum * sizeof(Elf32_Phdr));
+
+        for(unsigned int i = 0; i < hdr->e_phnum; i++) {
+                if(phdrs[i].p_offset > len || phdrs[i].p_filesz > len - phdrs[i].p_offset ||
+                   (phdrs[i].p_type == PH_LOAD && phdrs[i].p_filesz > phdrs[i].p_memsz)) {
+                        fprintf(stderr, "%s: segment %u is past the end of the file\n", path, i);
+                        free(file);
+                        return -1;
+                }
+                if(phdrs[i].p_type == PH_LOAD)
+                        image_size += (phdrs[i].p_memsz + RELOC_BENCH_ALIGN - 1) & ~(RELOC_BENCH_ALIGN - 1);
+                else if(phdrs[i].p_type == PH_SCE_RELOCATE && phdrs[i].p_filesz > reloc_size)
+                        reloc_size = phdrs[i].p_filesz;
+        }
+
+        image = allocLow(image_size + RELOC_BENCH_ALIGN);
+        scratch = malloc((ELF_RELOCATE_SCRATCH_ENTRIES(reloc_size) + 1) * sizeof(elf_relocate_entry));
+        if(image == NULL || scratch == NULL) {
+                fprintf(stderr, "%s: out of memory\n", path);
+                free(file);
+                return -1;
+        }
+
+        image_size = 0;
+        for(unsigned int i = 0; i < hdr->e_phnum; i++) {
+                if(phdrs[i].p_type != PH_LOAD) continue;
+
+                phdrs[i].p_vaddr = (Elf32_Addr)(uintptr_t)(image + image_size);
+                image_size += (phdrs[i].p_memsz + RELOC_BENCH_ALIGN - 1) & ~(RELOC_BENCH_ALIGN - 1);
+        }
+
+        if(check) {
+                int res = compare(path, file, phdrs, hdr->e_phnum, image, image_size, scratch);
+
+                free(scratch);
+                munmap(image, image_size + RELOC_BENCH_ALIGN);
+                free(file);
+                return res;
+        }
+
+        //Only the relocations are timed
+        for(unsigned int round = 0; round < rounds; round++) {
+                loadImage(file, phdrs, hdr->e_phnum);
+
+                start = now();
+                for(unsigned int i = 0; i < hdr->e_phnum; i++)
+                        if(phdrs[i].p_type == PH_SCE_RELOCATE)
+                                applied += elf_relocate_apply(file + phdrs[i].p_offset, phdrs[i].p_filesz,
+                                                              phdrs, hdr->e_phnum, scratch);
+                elapsed += now() - start;
+        }
+
+        printf("%s: %llu relocations per load, %.2f M relocations/s, %.1f us per load\n", path,
+               applied / rounds, elapsed > 0 ? applied / elapsed / 1e6 : 0, elapsed * 1e6 / rounds);
+
+        free(scratch);
+        munmap(image, image_size + RELOC_BENCH_ALIGN);
+        free(file);
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        unsigned int rounds = RELOC_BENCH_ROUNDS;
+        int first = 1, check = 0, res = 0;
+
+        for(; first < argc && argv[first][0] == '-'; first++) {
+                if(strcmp(argv[first], "-c") == 0) {
+                        check = 1;
+                }else if(strcmp(argv[first], "-n") == 0 && first + 1 < argc) {
+                        rounds = strtoul(argv[++first], NULL, 0);
+                }else{
+                        first = argc;
+                }
+        }
+        if(first >= argc || rounds == 0) {
+                fprintf(stderr, "usage: %s [-c] [-n rounds] homebrew.self...\n", argv[0]);
+                fprintf(stderr, "  -c  compare the images relocated by the per entry engine and elf_relocate_apply\n");
+                return 1;
+        }
+
+        for(int i = first; i < argc; i++)
+                if(bench(argv[i], rounds, check) < 0) res = 1;
+
+        return res;
+}
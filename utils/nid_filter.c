@@ -0,0 +1,112 @@
+/*
+   nid_filter.c : Rejects NIDs missing from the NID storage without searching it
+   Copyright (C) 2015  hgoel0974
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+#include <psp2/kernel/sysmem.h>
+#include "nid_filter.h"
+#include "bithacks.h"
+#include "utils.h"
+
+//Independent from the hash placing the entries in the NID storage table
+static inline SceUInt nid_filter_hash(SceUInt x)
+{
+        x ^= x >> 15;
+        x *= 0x2C1B3C6D;
+        x ^= x >> 12;
+        x *= 0x297A2D39;
+        x ^= x >> 15;
+        return x;
+}
+
+static inline SceUInt* nid_filter_block(const nid_filter *filter, SceUInt hash)
+{
+        return &filter->blocks[(hash & filter->mask) * NID_FILTER_BLOCK_WORDS];
+}
+
+void nid_filter_free(nid_filter *filter)
+{
+        if(filter->uid != 0) sceKernelFreeMemBlock(filter->uid);
+        filter->uid = 0;
+        filter->blocks = NULL;
+        filter->mask = 0;
+}
+
+//Replaces the filter with an empty one sized for count NIDs
+int nid_filter_reset(nid_filter *filter, SceUInt count)
+{
+        SceUInt blocks = 1;
+        void *p;
+
+        nid_filter_free(filter);
+
+        while(blocks * NID_FILTER_BLOCK_WORDS * 32 < count * NID_FILTER_BITS_PER_NID)
+                blocks <<= 1;
+
+        filter->uid = sceKernelAllocMemBlock("vhlNidFilter", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW,
+                                             FOUR_KB_ALIGN(blocks * NID_FILTER_BLOCK_WORDS * sizeof(SceUInt)), NULL);
+        if(filter->uid < 0) {
+                DEBUG_LOG("Failed to allocate NID filter 0x%08X", filter->uid);
+                filter->uid = 0;
+                return -1;
+        }
+        if(sceKernelGetMemBlockBase(filter->uid, &p) < 0) {
+                DEBUG_LOG_("Failed to retrieve NID filter memory");
+                nid_filter_free(filter);
+                return -1;
+        }
+
+        memset(p, 0, blocks * NID_FILTER_BLOCK_WORDS * sizeof(SceUInt));
+        filter->blocks = p;
+        filter->mask = blocks - 1;
+
+        return 0;
+}
+
+void nid_filter_add(nid_filter *filter, SceNID nid)
+{
+        SceUInt hash, bits;
+        SceUInt *block;
+
+        if(filter->blocks == NULL) return;
+
+        hash = nid_filter_hash(nid);
+        block = nid_filter_block(filter, hash);
+
+        //Each byte of the second hash picks one of the 256 bits of the block
+        bits = nid_filter_hash(hash);
+        for(int i = 0; i < NID_FILTER_HASHES; i++, bits >>= 8)
+                block[(bits & 0xFF) >> 5] |= 1 << (bits & 31);
+}
+
+__attribute__((hot))
+int nid_filter_mayContain(const nid_filter *filter, SceNID nid)
+{
+        const SceUInt *block;
+        SceUInt hash, bits;
+        SceUInt missing = 0;
+
+        if(filter->blocks == NULL) return 1;
+
+        hash = nid_filter_hash(nid);
+        block = nid_filter_block(filter, hash);
+
+        bits = nid_filter_hash(hash);
+        for(int i = 0; i < NID_FILTER_HASHES; i++, bits >>= 8)
+                missing |= ~block[(bits & 0xFF) >> 5] & (1 << (bits & 31));
+
+        return missing == 0;
+}
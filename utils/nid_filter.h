@@ -0,0 +1,41 @@
+/*
+VHL: Vita Homebrew Loader
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef _VHL_NID_FILTER_H_
+#define _VHL_NID_FILTER_H_
+
+#include <psp2/types.h>
+#include "../common.h"
+#include "../config.h"
+
+#define NID_FILTER_BLOCK_WORDS 8        //One 32 byte cache line per block
+#define NID_FILTER_HASHES 4
+
+//Blocked bloom filter, every NID sets NID_FILTER_HASHES bits in a single block
+typedef struct {
+        SceUID uid;
+        SceUInt *blocks;                //NULL when the filter could not be allocated, everything may then be present
+        SceUInt mask;                   //Blocks - 1
+} nid_filter;
+
+int nid_filter_reset(nid_filter *filter, SceUInt count);
+void nid_filter_add(nid_filter *filter, SceNID nid);
+int nid_filter_mayContain(const nid_filter *filter, SceNID nid);
+void nid_filter_free(nid_filter *filter);
+
+#endif
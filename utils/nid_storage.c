@@ -16,60 +16,902 @@
    along with this program; if not, write to the Free Software Foundation,
    Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
  */
+#include <psp2/kernel/sysmem.h>
+#include <psp2/io/fcntl.h>
 #include "nid_storage.h"
+#include "bithacks.h"
+#include "utils.h"
 #include "../vhl.h"
 
-int nid_storage_initialize()
+//Open addressing table with Robin Hood displacement, a NID of 0 marks an empty slot.
+//Entries are keyed by (library, NID) but placed by NID alone, so a NID exported by several
+//libraries stays on a single probe chain and can still be found when the library is unknown.
+//Entries are split in columns: NIDs, libraries, values and the types packed NID_STORAGE_TYPE_BITS each.
+
+#define NID_STORAGE_TYPE_MASK ((1 << NID_STORAGE_TYPE_BITS) - 1)
+#define NID_STORAGE_TYPES_PER_WORD (32 / NID_STORAGE_TYPE_BITS)
+
+//Batch order keys hold the home slot above the position in the batch
+#define NID_STORAGE_BATCH_SHIFT 8
+#define NID_STORAGE_BATCH_MASK ((1 << NID_STORAGE_BATCH_SHIFT) - 1)
+#define NID_STORAGE_PREFETCH_DISTANCE 4
+
+static inline int nid_storage_getType(const SceUInt *types, SceUInt i)
+{
+        return (types[i / NID_STORAGE_TYPES_PER_WORD] >> ((i % NID_STORAGE_TYPES_PER_WORD) * NID_STORAGE_TYPE_BITS)) & NID_STORAGE_TYPE_MASK;
+}
+
+static inline void nid_storage_setType(SceUInt *types, SceUInt i, int type)
+{
+        SceUInt shift = (i % NID_STORAGE_TYPES_PER_WORD) * NID_STORAGE_TYPE_BITS;
+        SceUInt *word = &types[i / NID_STORAGE_TYPES_PER_WORD];
+
+        *word = (*word & ~(NID_STORAGE_TYPE_MASK << shift)) | ((SceUInt)type << shift);
+}
+
+static inline void nid_storage_set(nid_storage_columns *columns, SceUInt i, SceNID library, SceNID nid, SceUInt value, int type)
+{
+        columns->nids[i] = nid;
+        if(columns->libraries != NULL) columns->libraries[i] = library;
+        columns->values[i] = value;
+        nid_storage_setType(columns->types, i, type);
+}
+
+static inline void nid_storage_copy(nid_storage_columns *dst, SceUInt i, const nid_storage_columns *src, SceUInt j)
+{
+        nid_storage_set(dst, i, src->libraries != NULL ? src->libraries[j] : 0, src->nids[j], src->values[j], nid_storage_getType(src->types, j));
+}
+
+static inline void nid_storage_get(const nid_storage_columns *columns, SceUInt i, nidTable_entry *entry)
+{
+        entry->nid = columns->nids[i];
+        entry->library = columns->libraries != NULL ? columns->libraries[i] : 0;
+        entry->type = nid_storage_getType(columns->types, i);
+        entry->value.i = columns->values[i];
+}
+
+static void nid_storage_swap(nid_storage_columns *columns, SceUInt a, SceUInt b)
+{
+        SceNID nid = columns->nids[a];
+        SceNID library = columns->libraries[a];
+        SceUInt value = columns->values[a];
+        int type = nid_storage_getType(columns->types, a);
+
+        nid_storage_copy(columns, a, columns, b);
+        nid_storage_set(columns, b, library, nid, value, type);
+}
+
+//Size of the columns for count entries, the types round up to a whole word
+static inline SceUInt nid_storage_columnsSize(SceUInt count, int libraries)
 {
-        nidTable_entry *nid_storage_table = getGlobals()->nid_storage_table;
+        return count * (sizeof(SceNID) + (libraries ? sizeof(SceNID) : 0) + sizeof(SceUInt)) +
+               (count + NID_STORAGE_TYPES_PER_WORD - 1) / NID_STORAGE_TYPES_PER_WORD * sizeof(SceUInt);
+}
 
-        for(int i = 0; i < NID_STORAGE_BUCKET_COUNT; i++)
+static void nid_storage_setColumns(nid_storage_columns *columns, void *p, SceUInt count, int libraries)
+{
+        columns->nids = p;
+        columns->libraries = libraries ? columns->nids + count : NULL;
+        columns->values = (SceUInt*)(columns->nids + (libraries ? 2 : 1) * count);
+        columns->types = columns->values + count;
+}
+
+static inline SceUInt nid_storage_hash(SceNID nid)
+{
+        //NIDs are truncated hashes already, but mix them so that every bit contributes to the slot
+        nid ^= nid >> 16;
+        nid *= 0x85EBCA6B;
+        nid ^= nid >> 13;
+        nid *= 0xC2B2AE35;
+        nid ^= nid >> 16;
+        return nid;
+}
+
+static inline SceUInt nid_storage_home(const nid_storage_columns *table, SceNID nid)
+{
+        return nid_storage_hash(nid) & table->mask;
+}
+
+static inline SceUInt nid_storage_distance(const nid_storage_columns *table, SceUInt slot, SceNID nid)
+{
+        return (slot - nid_storage_home(table, nid)) & table->mask;
+}
+
+//Walks the displacement chain of an insertion, only writing to the table when commit is set
+//so that a failing insertion never leaves a displaced entry behind
+static int nid_storage_insert(nid_storage_columns *table, SceNID library, SceNID nid, SceUInt value, int type, int commit)
+{
+        SceNID *nids = table->nids;
+        SceUInt slot = nid_storage_home(table, nid);
+        SceUInt dist = 0;
+        SceNID tmpNid, tmpLibrary;
+        SceUInt tmpValue;
+        int tmpType;
+
+        while(dist < NID_STORAGE_MAX_PROBE_LENGTH)
         {
-                nid_storage_table[i * NID_STORAGE_MAX_BUCKET_ENTRIES].nid = 0;
+                if(nids[slot] == 0) {
+                        if(commit) nid_storage_set(table, slot, library, nid, value, type);
+                        return 1;
+                }
+
+                //Only the entry being added can match, displaced ones are unique
+                if(nids[slot] == nid && table->libraries[slot] == library) {
+                        if(commit) nid_storage_set(table, slot, library, nid, value, type);
+                        return 0;
+                }
+
+                SceUInt slotDist = nid_storage_distance(table, slot, nids[slot]);
+                if(slotDist < dist) { //Take the slot from the richer entry and carry it on instead
+                        tmpNid = nids[slot];
+                        tmpLibrary = table->libraries[slot];
+                        if(commit) {
+                                tmpValue = table->values[slot];
+                                tmpType = nid_storage_getType(table->types, slot);
+                                nid_storage_set(table, slot, library, nid, value, type);
+                                value = tmpValue;
+                                type = tmpType;
+                        }
+                        nid = tmpNid;
+                        library = tmpLibrary;
+                        dist = slotDist;
+                }
+
+                slot = (slot + 1) & table->mask;
+                dist++;
+        }
+        return -1;
+}
+
+//Returns the slot holding the NID in the library, or in any library when anyLibrary is set
+static int nid_storage_probe(const nid_storage_columns *table, SceNID library, SceNID nid, int anyLibrary)
+{
+        const SceNID *nids = table->nids;
+        SceUInt slot = nid_storage_home(table, nid);
+
+        for(SceUInt dist = 0; dist < NID_STORAGE_MAX_PROBE_LENGTH; dist++)
+        {
+                if(nids[slot] == nid && (anyLibrary || table->libraries[slot] == library))
+                        return slot;
+
+                //Robin Hood ordering guarantees the NID would have been placed before a richer entry or a hole
+                if(nids[slot] == 0 || nid_storage_distance(table, slot, nids[slot]) < dist)
+                        return -1;
+
+                slot = (slot + 1) & table->mask;
+        }
+        return -1;
+}
+
+//Backward shift deletion, the entries following the slot move one step closer to their home
+static void nid_storage_remove(nid_storage_columns *table, SceUInt slot)
+{
+        SceUInt next = (slot + 1) & table->mask;
+
+        while(table->nids[next] != 0 && nid_storage_distance(table, next, table->nids[next]) > 0)
+        {
+                nid_storage_copy(table, slot, table, next);
+                slot = next;
+                next = (next + 1) & table->mask;
+        }
+        table->nids[slot] = 0;
+}
+
+static int nid_storage_allocColumns(nid_storage_columns *table, SceUID *uid, SceUInt keyBit)
+{
+        SceUInt capacity = 1 << keyBit;
+        void *p;
+
+        *uid = sceKernelAllocMemBlock("vhlNidStorage", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW,
+                                      FOUR_KB_ALIGN(nid_storage_columnsSize(capacity, 1)), NULL);
+        if(*uid < 0) {
+                DEBUG_LOG("Failed to allocate NID storage 0x%08X", *uid);
+                *uid = 0;
+                return -1;
+        }
+        if(sceKernelGetMemBlockBase(*uid, &p) < 0) {
+                DEBUG_LOG_("Failed to retrieve NID storage memory");
+                sceKernelFreeMemBlock(*uid);
+                *uid = 0;
+                return -1;
+        }
+
+        nid_storage_setColumns(table, p, capacity, 1);
+        table->mask = capacity - 1;
+        for(SceUInt i = 0; i < capacity; i++)
+        {
+                table->nids[i] = 0;
         }
 
         return 0;
 }
 
-__attribute__((hot))
-int nid_storage_addEntry(nidTable_entry *entry)
+//Smallest table keeping count entries under the load factor
+static SceUInt nid_storage_keyBitFor(SceUInt count)
+{
+        SceUInt keyBit = NID_STORAGE_INITIAL_KEY_BIT;
+
+        while(keyBit < NID_STORAGE_MAX_KEY_BIT && count * 100 > (1U << keyBit) * NID_STORAGE_MAX_LOAD_FACTOR)
+                keyBit++;
+
+        return keyBit;
+}
+
+//Sized for the entries the table takes before growing, or for the entries of the index
+static void nid_storage_rebuildFilter(nid_storage_state *storage)
 {
-        nidTable_entry *nid_storage_table = getGlobals()->nid_storage_table;
-        int key = (char)(entry->nid >> 24);
+        const nid_storage_library *run;
+        nid_filter *filter = &storage->filter;
+
+        if(storage->table.nids != NULL) {
+                if(nid_filter_reset(filter, (storage->table.mask + 1) / 100 * NID_STORAGE_MAX_LOAD_FACTOR) < 0) return;
+
+                for(SceUInt i = 0; i <= storage->table.mask; i++)
+                {
+                        if(storage->table.nids[i] != 0) nid_filter_add(filter, storage->table.nids[i]);
+                }
+        }else{
+                if(nid_filter_reset(filter, storage->index_count) < 0) return;
 
-        for(int i = (key * NID_STORAGE_MAX_BUCKET_ENTRIES); i < NID_STORAGE_BUCKET_COUNT * NID_STORAGE_MAX_BUCKET_ENTRIES; i++)
+                for(run = storage->libraries; run < storage->libraries + storage->library_count; run++)
+                {
+                        for(SceUInt slot = run->first; slot < run->first + run->count; slot++)
+                                nid_filter_add(filter, storage->index.nids[slot]);
+                }
+        }
+}
+
+static int nid_storage_allocTable(nid_storage_state *storage, SceUInt keyBit)
+{
+        storage->table.nids = NULL;
+        if(nid_storage_allocColumns(&storage->table, &storage->table_uid, keyBit) < 0) return -1;
+
+        storage->key_bit = keyBit;
+        storage->count = 0;
+        storage->library_bound = 0;
+        nid_storage_rebuildFilter(storage);
+
+        return 0;
+}
+
+//Moves the entries into a table twice as large, the current one is kept if any of them does not fit
+static int nid_storage_grow(nid_storage_state *storage)
+{
+        nid_storage_columns table;
+        SceUID uid;
+        SceUInt keyBit;
+
+        for(keyBit = storage->key_bit + 1; keyBit <= NID_STORAGE_MAX_KEY_BIT; keyBit++)
         {
-                if(nid_storage_table[i].nid == 0 || nid_storage_table[i].nid == entry->nid) { //Search for empty spot to add entry or update duplicate
+                if(nid_storage_allocColumns(&table, &uid, keyBit) < 0) return -1;
 
-                        //DEBUG_LOG("Entry %d", i);
-                        //Make sure that the next entry is only cleared if we aren't overwriting an existing entry
-                        if(nid_storage_table[i].nid != entry->nid && i + 1 < (key + 1) * NID_STORAGE_MAX_BUCKET_ENTRIES) nid_storage_table[i + 1].nid = 0;
+                SceUInt i;
+                for(i = 0; i <= storage->table.mask; i++)
+                {
+                        SceNID nid = storage->table.nids[i];
+                        if(nid == 0) continue;
 
-                        nid_storage_table[i].nid = entry->nid;
-                        nid_storage_table[i].type = entry->type;
-                        nid_storage_table[i].value.i = entry->value.i;
+                        SceNID library = storage->table.libraries[i];
+                        SceUInt value = storage->table.values[i];
+                        int type = nid_storage_getType(storage->table.types, i);
+                        if(nid_storage_insert(&table, library, nid, value, type, 0) < 0) break;
+                        nid_storage_insert(&table, library, nid, value, type, 1);
+                }
 
+                if(i > storage->table.mask) {
+                        sceKernelFreeMemBlock(storage->table_uid);
+                        storage->table_uid = uid;
+                        storage->table = table;
+                        storage->key_bit = keyBit;
+                        storage->stats.rehashes++;
+                        nid_storage_rebuildFilter(storage);
+                        DEBUG_LOG("NID storage grown to %d slots", table.mask + 1);
                         return 0;
                 }
+
+                sceKernelFreeMemBlock(uid);
         }
-        DEBUG_LOG_("Failed to add NID");
+
+        DEBUG_LOG_("NID storage cannot grow any further");
         return -1;
 }
 
-__attribute__((hot))
-int nid_storage_getEntry(SceNID nid, nidTable_entry *entry)
+static inline nid_storage_lookaside* nid_storage_lookasideSet(nid_storage_state *storage, SceNID library, SceNID nid)
+{
+        return storage->lookaside[nid_storage_hash(nid ^ library) & (NID_STORAGE_LOOKASIDE_SETS - 1)];
+}
+
+static int nid_storage_lookasideGet(nid_storage_state *storage, SceNID library, SceNID nid, nidTable_entry *entry)
+{
+        nid_storage_lookaside *set = nid_storage_lookasideSet(storage, library, nid);
+        nid_storage_lookaside hit;
+
+        if(set[0].nid == nid && set[0].library == library) {
+                hit = set[0];
+        }else if(set[1].nid == nid && set[1].library == library) {
+                hit = set[1];
+                set[1] = set[0];
+                set[0] = hit;
+        }else{
+                storage->stats.lookaside_misses++;
+                return -1;
+        }
+
+        entry->nid = nid;
+        entry->library = library;
+        entry->value.i = hit.value;
+        entry->type = hit.type;
+        storage->stats.lookaside_hits++;
+        return 0;
+}
+
+static void nid_storage_lookasidePut(nid_storage_state *storage, const nidTable_entry *entry)
+{
+        nid_storage_lookaside *set = nid_storage_lookasideSet(storage, entry->library, entry->nid);
+
+        set[1] = set[0];
+        set[0].nid = entry->nid;
+        set[0].library = entry->library;
+        set[0].value = entry->value.i;
+        set[0].type = entry->type;
+}
+
+//Only entries found in the storage are cached, so only changed or removed ones make it stale
+static void nid_storage_lookasideFlush(nid_storage_state *storage)
+{
+        memset(storage->lookaside, 0, sizeof(storage->lookaside));
+}
+
+static void nid_storage_lookasideInvalidate(nid_storage_state *storage, SceNID library, SceNID nid)
 {
-        nidTable_entry *nid_storage_table = getGlobals()->nid_storage_table;
-        int key = (char)(nid >> 24);
+        nid_storage_lookaside *set = nid_storage_lookasideSet(storage, library, nid);
 
-        for(int i = (key * NID_STORAGE_MAX_BUCKET_ENTRIES); i < (key + 1) * NID_STORAGE_MAX_BUCKET_ENTRIES; i++)
+        memset(set, 0, sizeof(storage->lookaside[0]));
+}
+
+//Entries arrive grouped by library, so counting the library changes bounds the size of the run directory
+static void nid_storage_countLibrary(nid_storage_state *storage, SceNID library)
+{
+        if(storage->library_bound == 0 || storage->last_library != library) storage->library_bound++;
+        storage->last_library = library;
+}
+
+int nid_storage_initialize()
+{
+        nid_storage_state *storage = &getGlobals()->nid_storage;
+
+        storage->index.nids = NULL;
+        storage->index_uid = 0;
+        storage->index_count = 0;
+        storage->libraries = NULL;
+        storage->library_count = 0;
+        memset(&storage->stats, 0, sizeof(storage->stats));
+        storage->filter.uid = 0;
+        storage->filter.blocks = NULL;
+        nid_storage_lookasideFlush(storage);
+
+        return nid_storage_allocTable(storage, NID_STORAGE_INITIAL_KEY_BIT);
+}
+
+static int nid_storage_insertEntry(nid_storage_state *storage, const nidTable_entry *entry)
+{
+        int res = nid_storage_insert(&storage->table, entry->library, entry->nid, entry->value.i, entry->type, 0);
+
+        //Grow when a new entry would cross the load factor or outruns the probe length
+        while(res < 0 || (res > 0 && (storage->count + 1) * 100 > (storage->table.mask + 1) * NID_STORAGE_MAX_LOAD_FACTOR))
         {
-                if(nid_storage_table[i].nid == nid) {
-                        entry->nid = nid_storage_table[i].nid;
-                        entry->type = nid_storage_table[i].type;
-                        entry->value.i = nid_storage_table[i].value.i;
+                if(nid_storage_grow(storage) < 0) {
+                        //Still fits, only more crowded than wanted, but the last hole is kept for the removals
+                        if(res > 0 && storage->count + 2 <= storage->table.mask + 1) break;
+                        DEBUG_LOG("Failed to add NID 0x%08x", entry->nid);
+                        storage->stats.failed_inserts++;
+                        return -1;
+                }
+                res = nid_storage_insert(&storage->table, entry->library, entry->nid, entry->value.i, entry->type, 0);
+        }
+
+        if(res == 0) {
+                storage->stats.overwrites++;
+
+                //The same entry again leaves the table and the cached copy as they are
+                int slot = nid_storage_probe(&storage->table, entry->library, entry->nid, 0);
+                if(slot >= 0 && storage->table.values[slot] == entry->value.i &&
+                   nid_storage_getType(storage->table.types, slot) == entry->type)
                         return 0;
+
+                nid_storage_insert(&storage->table, entry->library, entry->nid, entry->value.i, entry->type, 1);
+                nid_storage_lookasideInvalidate(storage, entry->library, entry->nid);
+                return 0;
+        }
+
+        nid_storage_insert(&storage->table, entry->library, entry->nid, entry->value.i, entry->type, 1);
+        storage->count++;
+        nid_filter_add(&storage->filter, entry->nid);
+        return 0;
+}
+
+//Whether the entry at position i of the batch order is added again later in the batch,
+//such repeats share the home slot and the later ones sort after it
+static int nid_storage_isRepeated(const nidTable_entry *entries, const SceUInt *order, SceUInt i, SceUInt n)
+{
+        const nidTable_entry *entry = &entries[order[i] & NID_STORAGE_BATCH_MASK];
+
+        for(SceUInt j = i + 1; j < n && (order[j] >> NID_STORAGE_BATCH_SHIFT) == (order[i] >> NID_STORAGE_BATCH_SHIFT); j++)
+        {
+                const nidTable_entry *other = &entries[order[j] & NID_STORAGE_BATCH_MASK];
+                if(other->nid == entry->nid && other->library == entry->library) return 1;
+        }
+        return 0;
+}
+
+//Adds the entries in slot order so that consecutive probes share cache lines and the next ones
+//can be prefetched, a NID repeated within the batch keeps its last value as with single additions
+__attribute__((hot))
+int nid_storage_addEntries(const nidTable_entry *entries, size_t count)
+{
+        nid_storage_state *storage = &getGlobals()->nid_storage;
+        SceUInt order[NID_STORAGE_BATCH_SIZE];
+        SceUInt n, i, j, key, home;
+        int res = 0;
+
+        if(storage->table.nids == NULL && nid_storage_thaw() < 0) return -1;
+
+        for(; count > 0; entries += n, count -= n)
+        {
+                n = count < NID_STORAGE_BATCH_SIZE ? count : NID_STORAGE_BATCH_SIZE;
+
+                //Insertion sort, the batches are small
+                for(i = 0; i < n; i++)
+                {
+                        nid_storage_countLibrary(storage, entries[i].library);
+
+                        key = (nid_storage_home(&storage->table, entries[i].nid) << NID_STORAGE_BATCH_SHIFT) | i;
+                        for(j = i; j > 0 && order[j - 1] > key; j--)
+                                order[j] = order[j - 1];
+                        order[j] = key;
                 }
+
+                for(i = 0; i < n; i++)
+                {
+                        if(i + NID_STORAGE_PREFETCH_DISTANCE < n) {
+                                home = order[i + NID_STORAGE_PREFETCH_DISTANCE] >> NID_STORAGE_BATCH_SHIFT;
+                                __builtin_prefetch(&storage->table.nids[home], 1);
+                                __builtin_prefetch(&storage->table.libraries[home], 1);
+                        }
+
+                        const nidTable_entry *entry = &entries[order[i] & NID_STORAGE_BATCH_MASK];
+                        if(entry->nid == 0) {
+                                storage->stats.failed_inserts++;
+                                res = -1;
+                                continue;
+                        }
+                        if(nid_storage_isRepeated(entries, order, i, n)) {
+                                storage->stats.overwrites++;
+                                continue;
+                        }
+
+                        if(nid_storage_insertEntry(storage, entry) < 0) res = -1;
+                }
+        }
+        return res;
+}
+
+int nid_storage_addEntry(const nidTable_entry *entry)
+{
+        return nid_storage_addEntries(entry, 1);
+}
+
+//Binary search of the run directory, which is sorted by library NID
+static const nid_storage_library* nid_storage_findLibrary(const nid_storage_state *storage, SceNID library)
+{
+        const nid_storage_library *base = storage->libraries;
+        SceUInt n = storage->library_count;
+
+        if(n == 0) return NULL;
+
+        while(n > 1)
+        {
+                SceUInt half = n / 2;
+                base = (base[half].library <= library) ? base + half : base;
+                n -= half;
+        }
+        return base->library == library ? base : NULL;
+}
+
+//Each run is an implicit tree in Eytzinger order, node k being stored at first + k - 1
+static int nid_storage_searchRun(const nid_storage_state *storage, const nid_storage_library *run, SceNID nid, nidTable_entry *entry)
+{
+        const SceNID *nids = &storage->index.nids[run->first];
+        SceUInt k = 1;
+
+        //Descend without branching on the comparison, then undo the right turns taken after the match
+        while(k <= run->count)
+        {
+                __builtin_prefetch(&nids[k * 16 - 1]);
+                k = 2 * k + (nids[k - 1] < nid);
+        }
+        k >>= __builtin_ctz(~k) + 1;
+
+        if(k == 0 || nids[k - 1] != nid) return -1;
+
+        nid_storage_get(&storage->index, run->first + k - 1, entry);
+        entry->library = run->library;
+        return 0;
+}
+
+__attribute__((hot))
+int nid_storage_getEntry(SceNID library, SceNID nid, nidTable_entry *entry)
+{
+        nid_storage_state *storage = &getGlobals()->nid_storage;
+        const nid_storage_library *run;
+        int slot;
+
+        storage->stats.lookups++;
+        if(nid == 0) goto miss;
+        if(nid_storage_lookasideGet(storage, library, nid, entry) == 0) return NID_STORAGE_FROM_LOOKASIDE;
+        if(!nid_filter_mayContain(&storage->filter, nid)) {
+                storage->stats.filter_rejects++;
+                goto miss;
         }
+
+        if(storage->table.nids == NULL) {
+                run = nid_storage_findLibrary(storage, library);
+                if(run == NULL || nid_storage_searchRun(storage, run, nid, entry) < 0) goto miss;
+        }else{
+                slot = nid_storage_probe(&storage->table, library, nid, 0);
+                if(slot < 0) goto miss;
+
+                nid_storage_get(&storage->table, slot, entry);
+        }
+
+        nid_storage_lookasidePut(storage, entry);
+        return 0;
+
+miss:
+        storage->stats.misses++;
         return -1;
 }
+
+//Looks the NID up in every library, for imports whose library is unknown or exported under another NID
+int nid_storage_findEntry(SceNID nid, nidTable_entry *entry)
+{
+        nid_storage_state *storage = &getGlobals()->nid_storage;
+        int slot;
+
+        storage->stats.lookups++;
+        if(nid == 0) goto miss;
+        if(!nid_filter_mayContain(&storage->filter, nid)) {
+                storage->stats.filter_rejects++;
+                goto miss;
+        }
+
+        if(storage->table.nids == NULL) {
+                for(SceUInt i = 0; i < storage->library_count; i++)
+                {
+                        if(nid_storage_searchRun(storage, &storage->libraries[i], nid, entry) == 0)
+                                return 0;
+                }
+                goto miss;
+        }
+
+        slot = nid_storage_probe(&storage->table, 0, nid, 1);
+        if(slot < 0) goto miss;
+
+        nid_storage_get(&storage->table, slot, entry);
+        return 0;
+
+miss:
+        storage->stats.misses++;
+        storage->stats.failed_lookups++;
+        return -1;
+}
+
+//Drops every entry of the library, returns the number of entries removed
+int nid_storage_removeLibrary(SceNID library)
+{
+        nid_storage_state *storage = &getGlobals()->nid_storage;
+        nid_storage_columns *table = &storage->table;
+        nid_storage_library *run;
+        SceUInt start, slot;
+        int removed = 0;
+
+        if(table->nids == NULL) {
+                //The run is left in place, it is simply not reachable anymore and goes away on the next thaw
+                run = (nid_storage_library*)nid_storage_findLibrary(storage, library);
+                if(run == NULL) return 0;
+
+                removed = run->count;
+                storage->index_count -= run->count;
+                storage->library_count--;
+                for(; run < storage->libraries + storage->library_count; run++)
+                        run[0] = run[1];
+
+                nid_storage_rebuildFilter(storage);
+                nid_storage_lookasideFlush(storage);
+                return removed;
+        }
+
+        if(storage->count == 0) return 0;
+
+        //Start right after a hole, no chain wraps around it so shifted entries are never skipped
+        for(start = 0; start <= table->mask && table->nids[start] != 0; start++);
+        if(start > table->mask) {
+                //Insertions always leave a hole, a full table means the columns were overwritten
+                DEBUG_LOG("No free slot in the NID storage, library 0x%08X not removed", library);
+                return 0;
+        }
+
+        for(SceUInt i = 1; i <= table->mask + 1; i++)
+        {
+                slot = (start + i) & table->mask;
+                while(table->nids[slot] != 0 && table->libraries[slot] == library)
+                {
+                        nid_storage_remove(table, slot);
+                        storage->count--;
+                        removed++;
+                }
+        }
+
+        //Bloom filters cannot forget a NID, start over from the remaining entries
+        if(removed > 0) {
+                nid_storage_rebuildFilter(storage);
+                nid_storage_lookasideFlush(storage);
+        }
+        return removed;
+}
+
+static void nid_storage_countProbeLengths(nid_storage_state *storage)
+{
+        nid_storage_stats *stats = &storage->stats;
+        SceUInt dist;
+
+        memset(stats->probe_lengths, 0, sizeof(stats->probe_lengths));
+        stats->max_probe = 0;
+
+        for(SceUInt i = 0; i <= storage->table.mask; i++)
+        {
+                if(storage->table.nids[i] == 0) continue;
+
+                dist = nid_storage_distance(&storage->table, i, storage->table.nids[i]);
+                if(dist > stats->max_probe) stats->max_probe = dist;
+                stats->probe_lengths[dist < NID_STORAGE_STATS_PROBE_LENGTHS ? dist : NID_STORAGE_STATS_PROBE_LENGTHS - 1]++;
+        }
+}
+
+static int nid_storage_less(const nid_storage_columns *columns, SceUInt a, SceUInt b)
+{
+        if(columns->libraries[a] != columns->libraries[b])
+                return columns->libraries[a] < columns->libraries[b];
+        return columns->nids[a] < columns->nids[b];
+}
+
+static void nid_storage_siftDown(nid_storage_columns *columns, SceUInt root, SceUInt count)
+{
+        SceUInt child;
+
+        while((child = 2 * root + 1) < count)
+        {
+                if(child + 1 < count && nid_storage_less(columns, child, child + 1)) child++;
+                if(!nid_storage_less(columns, root, child)) return;
+
+                nid_storage_swap(columns, root, child);
+                root = child;
+        }
+}
+
+//Heap sort by library then NID, the entries are sorted in place since there is no memory to spare
+static void nid_storage_sort(nid_storage_columns *columns, SceUInt count)
+{
+        for(SceUInt i = count / 2; i > 0; i--)
+                nid_storage_siftDown(columns, i - 1, count);
+
+        for(SceUInt i = count; i > 1; i--)
+        {
+                nid_storage_swap(columns, 0, i - 1);
+                nid_storage_siftDown(columns, 0, i - 1);
+        }
+}
+
+//In-order walk of the implicit tree of a run, which visits the nodes in sorted order
+static SceUInt nid_storage_layout(nid_storage_columns *index, SceUInt first, const nid_storage_columns *sorted, SceUInt i, SceUInt k, SceUInt count)
+{
+        if(k <= count) {
+                i = nid_storage_layout(index, first, sorted, i, 2 * k, count);
+                nid_storage_copy(index, first + k - 1, sorted, i);
+                i++;
+                i = nid_storage_layout(index, first, sorted, i, 2 * k + 1, count);
+        }
+        return i;
+}
+
+//Compacts the table into a dense index once the boot time scanning is over and releases the table.
+//The index holds one run per library, found through a directory sorted by library NID.
+int nid_storage_freeze()
+{
+        nid_storage_state *storage = &getGlobals()->nid_storage;
+        nid_storage_columns *table = &storage->table;
+        SceUInt count = 0, libraryCount = 0, first;
+        nid_storage_library *run;
+        void *p;
+
+        if(table->nids == NULL) return 0;
+
+        //Nothing to index, a zero sized block can not be allocated so the store is frozen without one
+        if(storage->count == 0) {
+                sceKernelFreeMemBlock(storage->table_uid);
+                storage->table_uid = 0;
+                table->nids = NULL;
+                storage->index.nids = NULL;
+                storage->index_count = 0;
+                storage->libraries = NULL;
+                storage->library_count = 0;
+                nid_storage_rebuildFilter(storage);
+
+                DEBUG_LOG_("NID storage frozen empty");
+                return 0;
+        }
+
+        storage->index_uid = sceKernelAllocMemBlock("vhlNidIndex", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW,
+                                                    FOUR_KB_ALIGN(nid_storage_columnsSize(storage->count, 0) +
+                                                                  storage->library_bound * sizeof(nid_storage_library)), NULL);
+        if(storage->index_uid < 0) {
+                DEBUG_LOG("Failed to allocate NID index 0x%08X", storage->index_uid);
+                storage->index_uid = 0;
+                return -1;
+        }
+        if(sceKernelGetMemBlockBase(storage->index_uid, &p) < 0) {
+                DEBUG_LOG_("Failed to retrieve NID index memory");
+                sceKernelFreeMemBlock(storage->index_uid);
+                storage->index_uid = 0;
+                return -1;
+        }
+
+        //The probe lengths are lost with the table
+        nid_storage_countProbeLengths(storage);
+
+        //The table is dropped afterwards, so its front can hold the sorted entries
+        for(SceUInt i = 0; i <= table->mask; i++)
+        {
+                if(table->nids[i] != 0) {
+                        nid_storage_copy(table, count, table, i);
+                        count++;
+                }
+        }
+        nid_storage_sort(table, count);
+
+        nid_storage_setColumns(&storage->index, p, count, 0);
+        storage->libraries = (nid_storage_library*)((uintptr_t)p + nid_storage_columnsSize(count, 0));
+        storage->index_count = count;
+
+        run = storage->libraries;
+        for(first = 0; first < count; first += run->count, run++)
+        {
+                libraryCount++;
+                run->library = table->libraries[first];
+                run->first = first;
+                for(run->count = 1; first + run->count < count && table->libraries[first + run->count] == run->library; run->count++);
+
+                nid_storage_layout(&storage->index, first, table, first, 1, run->count);
+        }
+        storage->library_count = libraryCount;
+
+        sceKernelFreeMemBlock(storage->table_uid);
+        storage->table_uid = 0;
+        table->nids = NULL;
+        nid_storage_rebuildFilter(storage);
+
+        DEBUG_LOG("NID storage frozen with %d entries in %d libraries", count, libraryCount);
+        return 0;
+}
+
+//Turns the index back into a table so that more entries can be added
+int nid_storage_thaw()
+{
+        nid_storage_state *storage = &getGlobals()->nid_storage;
+        nid_storage_columns *index = &storage->index;
+        const nid_storage_library *run;
+        nidTable_entry entry;
+
+        if(storage->table.nids != NULL) return 0;
+        if(nid_storage_allocTable(storage, nid_storage_keyBitFor(storage->index_count + 1)) < 0) return -1;
+
+        //Removed libraries left their runs behind, only the ones in the directory are restored
+        for(run = storage->libraries; run < storage->libraries + storage->library_count; run++)
+        {
+                for(SceUInt slot = run->first; slot < run->first + run->count; slot++)
+                {
+                        nid_storage_get(index, slot, &entry);
+                        entry.library = run->library;
+                        if(nid_storage_insertEntry(storage, &entry) == 0)
+                                nid_storage_countLibrary(storage, run->library);
+                }
+        }
+
+        if(storage->index_uid != 0) sceKernelFreeMemBlock(storage->index_uid);
+        storage->index_uid = 0;
+        index->nids = NULL;
+        storage->index_count = 0;
+        storage->libraries = NULL;
+        storage->library_count = 0;
+
+        return 0;
+}
+
+void nid_storage_getStats(nid_storage_stats *stats)
+{
+        nid_storage_state *storage = &getGlobals()->nid_storage;
+
+        if(storage->table.nids != NULL) {
+                nid_storage_countProbeLengths(storage);
+                storage->stats.frozen = 0;
+                storage->stats.entries = storage->count;
+                storage->stats.capacity = storage->table.mask + 1;
+                storage->stats.libraries = 0;
+        }else{
+                storage->stats.frozen = 1;
+                storage->stats.entries = storage->index_count;
+                storage->stats.capacity = storage->index_count;
+                storage->stats.libraries = storage->library_count;
+        }
+        storage->stats.size = sizeof(nid_storage_stats);
+
+        memcpy(stats, &storage->stats, sizeof(nid_storage_stats));
+}
+
+#define NID_STORAGE_STATS_PRINT(...) do { \
+        len = snprintf(line, sizeof(line), __VA_ARGS__); \
+        if(sceIoWrite(fd, line, len) != len) res = -1; \
+} while(0)
+
+int nid_storage_dumpStats(const char *path)
+{
+        nid_storage_stats stats;
+        char line[64];
+        SceUID fd;
+        int len, res = 0;
+
+        nid_storage_getStats(&stats);
+
+        fd = sceIoOpen(path, PSP2_O_WRONLY | PSP2_O_CREAT | PSP2_O_TRUNC, 0777);
+        if(fd < 0) {
+                DEBUG_LOG("Failed to open NID statistics file 0x%08X", fd);
+                return -1;
+        }
+
+        NID_STORAGE_STATS_PRINT("%s\n", stats.frozen ? "frozen" : "table");
+        NID_STORAGE_STATS_PRINT("entries %u/%u\n", stats.entries, stats.capacity);
+        NID_STORAGE_STATS_PRINT("libraries %u\n", stats.libraries);
+        NID_STORAGE_STATS_PRINT("rehashes %u\n", stats.rehashes);
+        NID_STORAGE_STATS_PRINT("failed inserts %u\n", stats.failed_inserts);
+        NID_STORAGE_STATS_PRINT("overwrites %u\n", stats.overwrites);
+        NID_STORAGE_STATS_PRINT("lookups %u\n", stats.lookups);
+        NID_STORAGE_STATS_PRINT("misses %u\n", stats.misses);
+        NID_STORAGE_STATS_PRINT("failed lookups %u\n", stats.failed_lookups);
+        NID_STORAGE_STATS_PRINT("filter rejects %u\n", stats.filter_rejects);
+        NID_STORAGE_STATS_PRINT("lookaside hits %u misses %u\n", stats.lookaside_hits, stats.lookaside_misses);
+        NID_STORAGE_STATS_PRINT("max probe %u\n", stats.max_probe);
+        for(int i = 0; i < NID_STORAGE_STATS_PROBE_LENGTHS; i++)
+                NID_STORAGE_STATS_PRINT("probe %d%s %u\n", i, i == NID_STORAGE_STATS_PROBE_LENGTHS - 1 ? "+" : "", stats.probe_lengths[i]);
+
+        sceIoClose(fd);
+        return res;
+}
+
+int vhlGetNidStorageStats(nid_storage_stats *stats, SceUInt size)
+{
+        nid_storage_stats current;
+
+        if(stats == NULL) return -1;
+
+        nid_storage_getStats(&current);
+        if(size > sizeof(current)) size = sizeof(current);
+        current.size = size;
+        memcpy(stats, &current, size);
+
+        return size;
+}
+
+int vhlDumpNidStorageStats(const char *path)
+{
+        return nid_storage_dumpStats(path != NULL ? path : NID_STORAGE_STATS_FILE);
+}
@@ -22,10 +22,16 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #include <psp2/types.h>
 #include "../common.h"
 #include "../config.h"
+#include "nid_filter.h"
 
-#define NID_STORAGE_KEY_BIT 8
-#define NID_STORAGE_BUCKET_COUNT (1 << NID_STORAGE_KEY_BIT)
+#define NID_STORAGE_INITIAL_KEY_BIT 10   //The table starts with 1 << NID_STORAGE_INITIAL_KEY_BIT slots and doubles when full
+#define NID_STORAGE_MAX_KEY_BIT 20
+#define NID_STORAGE_TYPE_BITS 2
 #define NID_STORAGE_CACHE_FILE VHL_DATA_PATH"/nidCache.bin"
+#define NID_STORAGE_LIBRARY_VHL 0       //Library of the hooks and exports provided by VHL itself
+#define NID_STORAGE_STATS_FILE VHL_DATA_PATH"/nidStats.txt"
+#define NID_STORAGE_STATS_PROBE_LENGTHS 16
+#define NID_STORAGE_FROM_LOOKASIDE 1    //Returned by nid_storage_getEntry when the lookaside answered
 
 
 typedef enum  {
@@ -34,9 +40,10 @@ typedef enum  {
         ENTRY_TYPES_VARIABLE
 }EntryTypes;
 
-//Represents an entry in the NID table
+//Represents an entry in the NID table, this is only the exchange format as the storage keeps its entries in columns
 typedef struct {
         SceNID nid;
+        SceNID library;                 //module_nid of the library exporting the NID
         int type;
         union {
                 void *p;
@@ -44,8 +51,78 @@ typedef struct {
         } value;
 } nidTable_entry;
 
+typedef struct {
+        SceNID *nids;
+        SceNID *libraries;              //Only kept by the table, the index groups its entries by library instead
+        SceUInt *values;
+        SceUInt *types;                 //EntryTypes packed NID_STORAGE_TYPE_BITS per entry
+        SceUInt mask;                   //Slots - 1, only for the table
+} nid_storage_columns;
+
+//Run of the index holding the entries of one library
+typedef struct {
+        SceNID library;
+        SceUInt first;
+        SceUInt count;
+} nid_storage_library;
+
+//Also returned to homebrew by vhlGetNidStorageStats, only append new fields
+typedef struct {
+        SceUInt size;                   //Bytes of the structure that were filled
+        SceUInt frozen;
+        SceUInt entries;
+        SceUInt capacity;               //Slots of the table, or entries of the index while frozen
+        SceUInt libraries;              //Runs of the index, 0 until frozen
+        SceUInt max_probe;
+        SceUInt probe_lengths[NID_STORAGE_STATS_PROBE_LENGTHS]; //Entries per distance from their home slot, the last one
+                                                                //also counts the longer ones. Taken when freezing.
+        SceUInt failed_inserts;
+        SceUInt overwrites;             //Entries added again with the same library and NID
+        SceUInt lookups;
+        SceUInt misses;                 //Lookups that failed, including the ones retried in another library
+        SceUInt failed_lookups;         //NIDs that were not found in any library
+        SceUInt rehashes;               //Times the table grew
+        SceUInt filter_rejects;         //Lookups answered by the bloom filter alone
+        SceUInt lookaside_hits;
+        SceUInt lookaside_misses;
+} nid_storage_stats;
+
+typedef struct {
+        SceNID nid;                     //0 when unused
+        SceNID library;
+        SceUInt value;
+        SceUInt type;
+} nid_storage_lookaside;
+
+typedef struct {
+        SceUID table_uid;
+        nid_storage_columns table;      //Robin Hood table receiving new entries, no NIDs while frozen
+        SceUInt key_bit;
+        SceUInt count;
+        SceUInt library_bound;          //Upper bound of the libraries in the table
+        SceNID last_library;
+        SceUID index_uid;
+        nid_storage_columns index;      //Runs sorted by NID in Eytzinger order, no NIDs until frozen
+        SceUInt index_count;
+        nid_storage_library *libraries; //Run directory sorted by library NID
+        SceUInt library_count;
+        nid_filter filter;              //Every NID of the table or index
+        nid_storage_lookaside lookaside[NID_STORAGE_LOOKASIDE_SETS][2]; //Most recently used way first, kept across launches
+        nid_storage_stats stats;
+} nid_storage_state;
+
 int nid_storage_initialize();
-int nid_storage_addEntry(nidTable_entry *entry);
-int nid_storage_getEntry(SceNID nid, nidTable_entry *entry);
+int nid_storage_addEntry(const nidTable_entry *entry);
+int nid_storage_addEntries(const nidTable_entry *entries, size_t count);
+int nid_storage_getEntry(SceNID library, SceNID nid, nidTable_entry *entry);
+int nid_storage_findEntry(SceNID nid, nidTable_entry *entry);
+int nid_storage_removeLibrary(SceNID library);
+int nid_storage_freeze(void);
+int nid_storage_thaw(void);
+void nid_storage_getStats(nid_storage_stats *stats);
+int nid_storage_dumpStats(const char *path);
+
+int vhlGetNidStorageStats(nid_storage_stats *stats, SceUInt size);
+int vhlDumpNidStorageStats(const char *path);
 
 #endif
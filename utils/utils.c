@@ -93,6 +93,30 @@ int strcmp(const char *a, const char *b)
         return 1;
 }
 
+int memcmp(const void *a, const void *b, size_t len)
+{
+        const unsigned char *a_ptr = a;
+        const unsigned char *b_ptr = b;
+
+        for(size_t i = 0; i < len; i++)
+        {
+                if(a_ptr[i] != b_ptr[i]) return a_ptr[i] - b_ptr[i];
+        }
+        return 0;
+}
+
+SceUInt hash_fnv1a(SceUInt hash, const void *data, SceUInt len)
+{
+        const unsigned char *ptr = data;
+
+        for(SceUInt i = 0; i < len; i++)
+        {
+                hash ^= ptr[i];
+                hash *= 0x01000193;
+        }
+        return hash;
+}
+
 void make_delta1(int *delta1, char *pat, int patlen) {
         int i;
         for (i=0; i < ALPHABET_LEN; i++) {
@@ -29,5 +29,9 @@ int strcpy(char *dst, const char *src);
 int substr(char *dst, const char *src, int start, size_t len);
 char* strcat(char *dest, const char *src);
 int strcmp(const char *a, const char *b);
+int memcmp(const void *a, const void *b, size_t len);
+
+#define HASH_FNV1A_INIT 0x811C9DC5
+SceUInt hash_fnv1a(SceUInt hash, const void *data, SceUInt len);
 
 #endif
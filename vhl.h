@@ -27,6 +27,9 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 #include <psp2/kernel/threadmgr.h>
 
 #include "utils/nid_storage.h"
+#include "nid_db.h"
+#include "vm_patch.h"
+#include "module_scan.h"
 #include "module_headers.h"
 #include "common.h"
 #include "config.h"
@@ -35,7 +38,12 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
 typedef struct {
         int intOptions[INT_VARIABLE_OPTION_COUNT];
         allocData allocatedBlocks[MAX_SLOTS];
-        nidTable_entry nid_storage_table[NID_STORAGE_BUCKET_COUNT * NID_STORAGE_MAX_BUCKET_ENTRIES];
+        nid_db_state nid_db;
+        nid_storage_state nid_storage;
+        vm_patch_state vm_patch;
+        module_scan_set scanned_modules;
+        module_scan_located located_modules[1 << NID_TABLE_LOCATED_BITS];
+        elf_parser_report load_report;
 } globals_t;
 
 typedef struct {
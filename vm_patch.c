@@ -0,0 +1,85 @@
+/*
+vm_patch.c : Sessions writing to executable memory
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#include <psp2/kernel/sysmem.h>
+#include <psp2/kernel/threadmgr.h>
+#include "vm_patch.h"
+#include "vhl.h"
+
+//Called by the boot as soon as the globals exist, the boot patches its own stubs before threads are enabled
+void vm_patch_initialize()
+{
+        vm_patch_state *session = &getGlobals()->vm_patch;
+
+        session->depth = 0;
+        session->threaded = 0;
+        session->lock = 0;
+        session->owner = VM_PATCH_NO_OWNER;
+}
+
+//Called by the boot once sceKernelGetThreadId and sceKernelDelayThread are resolved,
+//from then on homebrew threads may patch stubs while another load is going on
+void vm_patch_enableThreads()
+{
+        vm_patch_state *session = &getGlobals()->vm_patch;
+
+        //No session is open at that point of the boot
+        session->depth = 0;
+        session->lock = 0;
+        session->owner = VM_PATCH_NO_OWNER;
+        session->threaded = 1;
+}
+
+static void vm_patch_lock(vm_patch_state *session)
+{
+        SceUID thid = sceKernelGetThreadId();
+
+        //Only the thread holding the lock can find itself as the owner, nested sessions go through
+        if(session->owner == thid) return;
+
+        while(__sync_lock_test_and_set(&session->lock, 1))
+                sceKernelDelayThread(VM_PATCH_LOCK_DELAY);
+        session->owner = thid;
+}
+
+void vm_patch_begin()
+{
+        globals_t *globals = getGlobals();
+
+        if(globals->vm_patch.threaded) vm_patch_lock(&globals->vm_patch);
+
+        if(globals->vm_patch.depth++ == 0) sceKernelOpenVMDomain();
+        else globals->intOptions[VARIABLE_VM_TRANSITIONS_SAVED - 1] += 2;      //The open and the close of a nested session
+}
+
+void vm_patch_end()
+{
+        vm_patch_state *session = &getGlobals()->vm_patch;
+
+        if(session->depth == 0) {
+                DEBUG_LOG_("Unbalanced VM patch session");
+                return;
+        }
+        if(--session->depth > 0) return;
+
+        sceKernelCloseVMDomain();
+        if(session->threaded) {
+                session->owner = VM_PATCH_NO_OWNER;
+                __sync_lock_release(&session->lock);
+        }
+}
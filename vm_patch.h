@@ -0,0 +1,42 @@
+/*
+vm_patch.h : Sessions writing to executable memory
+Copyright (C) 2015  hgoel0974
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+*/
+#ifndef VHL_VM_PATCH_H
+#define VHL_VM_PATCH_H
+
+#include <psp2/types.h>
+
+#define VM_PATCH_NO_OWNER -1
+#define VM_PATCH_LOCK_DELAY 100        //Microseconds between attempts to enter a session held by another thread
+
+//Writes to executable memory happen inside a session, the VM domain is only
+//opened by the outermost one so a whole load pays a single pair of transitions.
+//Once threads are enabled a session belongs to one thread, the others wait for it to end.
+typedef struct {
+        SceUInt depth;
+        SceUInt threaded;               //Unset during the boot, before the thread functions are resolved
+        volatile SceUInt lock;
+        volatile SceUID owner;
+} vm_patch_state;
+
+void vm_patch_initialize(void);
+void vm_patch_enableThreads(void);
+void vm_patch_begin(void);
+void vm_patch_end(void);
+
+#endif